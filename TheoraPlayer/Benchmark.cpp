@@ -0,0 +1,1131 @@
+// Copyright (c) Promit Roy.
+// All rights reserved.
+//
+// This code is licensed under the MIT License.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+//Command line benchmarks for the player library. Build this file together with TheoraPlayer.cpp,
+//ColorConvert.cpp, SeekIndex.cpp and the codec libraries, in place of Player.cpp.
+//
+//  Benchmark convert [width height iterations]
+//  Benchmark stripes file.ogv [iterations]
+//  Benchmark seek file.ogv [seeks]
+//  Benchmark read file.ogv
+//  Benchmark schedule file.ogv [rate]
+//  Benchmark skip file.ogv [every]
+//  Benchmark postproc file.ogv [busythreads]
+//  Benchmark soak file.ogv [loops]
+//  Benchmark streams file.ogv
+//  Benchmark crc [megabytes]
+//  Benchmark demux file.ogv [passes]
+//  Benchmark compact file.ogv
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "TheoraPlayer.h"
+#include "ColorConvert.h"
+#include <ogg/ogg.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <unistd.h>
+#endif
+
+static double Seconds()
+{
+	using namespace std::chrono;
+	return duration_cast<duration<double>>(high_resolution_clock::now().time_since_epoch()).count();
+}
+
+static const char* FormatName(THEORAPLAYER_VideoFormat format)
+{
+	switch(format)
+	{
+	case THEORAPLAYER_VIDFMT_YV12: return "YV12";
+	case THEORAPLAYER_VIDFMT_IYUV: return "IYUV";
+	case THEORAPLAYER_VIDFMT_RGB: return "RGB";
+	case THEORAPLAYER_VIDFMT_RGBA: return "RGBA";
+	case THEORAPLAYER_VIDFMT_BGR: return "BGR";
+	case THEORAPLAYER_VIDFMT_BGRA: return "BGRA";
+	}
+	return "?";
+}
+
+static const char* PathName(THEORAPLAYER_ConvertPath path)
+{
+	switch(path)
+	{
+	case THEORAPLAYER_CVT_SCALAR: return "scalar";
+	case THEORAPLAYER_CVT_SSE2: return "sse2";
+	case THEORAPLAYER_CVT_AVX2: return "avx2";
+	}
+	return "?";
+}
+
+static const THEORAPLAYER_VideoFormat kPackedFormats[] = { THEORAPLAYER_VIDFMT_RGB, THEORAPLAYER_VIDFMT_RGBA, THEORAPLAYER_VIDFMT_BGR, THEORAPLAYER_VIDFMT_BGRA };
+
+//Synthetic 4:2:0 image with every sample value represented
+struct Planes
+{
+	int width, height;
+	std::vector<unsigned char> y, cb, cr;
+
+	Planes(int w, int h) : width(w), height(h), y(w * h), cb(((w + 1) / 2) * ((h + 1) / 2)), cr(cb.size())
+	{
+		unsigned int seed = 12345;
+		for(auto* plane : { &y, &cb, &cr })
+			for(auto& s : *plane)
+			{
+				seed = seed * 1103515245 + 12345;
+				s = (unsigned char)(seed >> 16);
+			}
+	}
+
+	void Convert(THEORAPLAYER_ConvertRowFn rowfn, unsigned char* dst, int bpp) const
+	{
+		const int cstride = (width + 1) / 2;
+		THEORAPLAYER_Convert420(rowfn, y.data(), width, cb.data(), cstride, cr.data(), cstride, width, height, dst, width * bpp);
+	}
+};
+
+//Every SIMD kernel must match the scalar reference byte for byte, including the ragged tails
+static int VerifyConvert()
+{
+	int failures = 0;
+	for(int w = 1; w <= 97; w++)
+	{
+		Planes planes(w, 6);
+		for(auto format : kPackedFormats)
+		{
+			const int bpp = THEORAPLAYER_BytesPerPixel(format);
+			std::vector<unsigned char> ref(w * 6 * bpp), out(w * 6 * bpp);
+			planes.Convert(THEORAPLAYER_GetConvertRowFn(format, THEORAPLAYER_CVT_SCALAR), ref.data(), bpp);
+			for(auto path : { THEORAPLAYER_CVT_SSE2, THEORAPLAYER_CVT_AVX2 })
+			{
+				memset(out.data(), 0xCD, out.size());
+				planes.Convert(THEORAPLAYER_GetConvertRowFn(format, path), out.data(), bpp);
+				if(memcmp(ref.data(), out.data(), ref.size()) != 0)
+				{
+					printf("MISMATCH: %s %s width %d\n", PathName(path), FormatName(format), w);
+					failures++;
+				}
+			}
+		}
+	}
+	return failures;
+}
+
+static int BenchConvert(int argc, char** argv)
+{
+	const int width = argc > 0 ? atoi(argv[0]) : 1920;
+	const int height = argc > 1 ? atoi(argv[1]) : 1080;
+	const int iterations = argc > 2 ? atoi(argv[2]) : 200;
+
+	const THEORAPLAYER_ConvertPath best = THEORAPLAYER_DetectConvertPath();
+	printf("CPU supports: %s\n", PathName(best));
+
+	const int failures = VerifyConvert();
+	printf("bit-exact check: %s\n", failures ? "FAILED" : "ok");
+
+	Planes planes(width, height);
+	std::vector<unsigned char> out(width * height * 4);
+	printf("%dx%d, %d iterations\n", width, height, iterations);
+	for(auto format : kPackedFormats)
+	{
+		const int bpp = THEORAPLAYER_BytesPerPixel(format);
+		for(int p = THEORAPLAYER_CVT_SCALAR; p <= best; p++)
+		{
+			const auto rowfn = THEORAPLAYER_GetConvertRowFn(format, (THEORAPLAYER_ConvertPath)p);
+			planes.Convert(rowfn, out.data(), bpp);  //warm up
+			const double start = Seconds();
+			for(int i = 0; i < iterations; i++)
+				planes.Convert(rowfn, out.data(), bpp);
+			const double elapsed = Seconds() - start;
+			printf("  %-5s %-7s %9.1f MP/s\n", FormatName(format), PathName((THEORAPLAYER_ConvertPath)p),
+				(double)width * height * iterations / elapsed / 1e6);
+		}
+	}
+	return failures ? 1 : 0;
+}
+
+//Decodes a whole file, returning the number of frames and a hash of every output pixel
+static int DecodeFile(const char* filename, THEORAPLAYER_VideoFormat format, THEORAPLAYER_ConvertMode mode, double& seconds, unsigned long long& hash)
+{
+	TheoraPlayer player;
+	if(player.OpenDecode(filename, format) <= 0 || player.SetConvertMode(mode) <= 0 || player.Prepare() <= 0)
+		return -1;
+
+	THEORAPLAYER_VideoFrame frame = {};
+	int frames = 0;
+	hash = 14695981039346656037ull;
+	seconds = 0.0;
+	while(player.IsDecoding())
+	{
+		const double start = Seconds();
+		const int result = player.GetVideoFrame(&frame);
+		seconds += Seconds() - start;
+		if(result < 0)
+			return -1;
+		if(result == 0)
+			continue;
+
+		frames++;
+		const size_t size = THEORAPLAYER_BytesPerPixel(format) ? frame.width * frame.height * THEORAPLAYER_BytesPerPixel(format) : frame.width * frame.height * 3 / 2;
+		for(size_t i = 0; i < size; i++)
+			hash = (hash ^ frame.pixels[i]) * 1099511628211ull;
+	}
+	player.FreeFrameData(&frame);
+	return frames;
+}
+
+static int BenchStripes(int argc, char** argv)
+{
+	if(argc < 1)
+		return -1;
+	const char* filename = argv[0];
+	const int iterations = argc > 1 ? atoi(argv[1]) : 3;
+
+	int failures = 0;
+	printf("%s, best of %d\n", filename, iterations);
+	for(auto format : { THEORAPLAYER_VIDFMT_IYUV, THEORAPLAYER_VIDFMT_RGB, THEORAPLAYER_VIDFMT_BGRA })
+	{
+		double best[2] = { 1e30, 1e30 };
+		unsigned long long hash[2] = {};
+		int frames = 0;
+		for(int i = 0; i < iterations; i++)
+		{
+			for(int mode = THEORAPLAYER_CONVERT_FRAME; mode <= THEORAPLAYER_CONVERT_STRIPES; mode++)
+			{
+				double seconds;
+				frames = DecodeFile(filename, format, (THEORAPLAYER_ConvertMode)mode, seconds, hash[mode]);
+				if(frames <= 0)
+				{
+					printf("failed to decode %s\n", filename);
+					return 1;
+				}
+				if(seconds < best[mode])
+					best[mode] = seconds;
+			}
+		}
+		const bool match = hash[0] == hash[1];
+		failures += !match;
+		printf("  %-5s frame %7.3f ms/frame  stripes %7.3f ms/frame  (%+.1f%%)  %s\n", FormatName(format),
+			best[0] * 1000.0 / frames, best[1] * 1000.0 / frames, (best[1] / best[0] - 1.0) * 100.0, match ? "identical" : "MISMATCH");
+	}
+	return failures ? 1 : 0;
+}
+
+static unsigned long long HashFrame(const THEORAPLAYER_VideoFrame& frame)
+{
+	unsigned long long hash = 14695981039346656037ull;
+	const size_t bpp = THEORAPLAYER_BytesPerPixel(frame.format);
+	const size_t size = bpp ? frame.width * frame.height * bpp : frame.width * frame.height + 2 * (frame.width / 2) * (frame.height / 2);
+	for(size_t i = 0; i < size; i++)
+		hash = (hash ^ frame.pixels[i]) * 1099511628211ull;
+	return hash;
+}
+
+//Size of a file in bytes, or -1 if it can't be opened
+static long FileBytes(const char* filename)
+{
+	FILE* f = fopen(filename, "rb");
+	if(!f)
+		return -1;
+	fseek(f, 0, SEEK_END);
+	const long bytes = ftell(f);
+	fclose(f);
+	return bytes;
+}
+
+//Seek latency against the cost of decoding up to the same point, checking every landing frame
+//against a straight decode of the file, with and without a seek index
+static int BenchSeek(int argc, char** argv)
+{
+	if(argc < 1)
+		return -1;
+	const char* filename = argv[0];
+	const int seeks = argc > 1 ? atoi(argv[1]) : 50;
+
+	const long bytes = FileBytes(filename);
+	if(bytes < 0)
+	{
+		printf("failed to open %s\n", filename);
+		return 1;
+	}
+
+	//reference pass
+	std::vector<unsigned int> times;
+	std::vector<unsigned long long> hashes;
+	double linear = 0.0;
+	{
+		TheoraPlayer player;
+		if(player.OpenDecode(filename, THEORAPLAYER_VIDFMT_IYUV) <= 0 || player.Prepare() <= 0)
+		{
+			printf("failed to decode %s\n", filename);
+			return 1;
+		}
+		THEORAPLAYER_VideoFrame frame = {};
+		const double start = Seconds();
+		while(player.IsDecoding())
+		{
+			const int result = player.GetVideoFrame(&frame);
+			if(result < 0)
+				return 1;
+			if(result == 0)
+				continue;
+			times.push_back(frame.playms);
+			hashes.push_back(HashFrame(frame));
+		}
+		linear = Seconds() - start;
+		player.FreeFrameData(&frame);
+	}
+	if(times.empty())
+		return 1;
+	const unsigned int duration = times.back();
+
+	printf("%s: %ld bytes, %u ms, %d frames, full decode %.1f ms\n", filename, bytes, duration, (int)times.size(), linear * 1000.0);
+
+	//the same seeks again with a keyframe index beside the file, which replaces the bisection
+	const std::string indexname = std::string(filename) + ".seekidx";
+	const double buildstart = Seconds();
+	if(THEORAPLAYER_BuildSeekIndex(filename, indexname.c_str()) <= 0)
+	{
+		printf("failed to build %s\n", indexname.c_str());
+		return 1;
+	}
+	const double build = Seconds() - buildstart;
+
+	int failures = 0;
+	for(int indexed = 0; indexed <= 1; indexed++)
+	{
+		TheoraPlayer player;
+		if(player.OpenDecode(filename, THEORAPLAYER_VIDFMT_IYUV) <= 0 || player.Prepare() <= 0)
+			return 1;
+		if(indexed && player.LoadSeekIndex(indexname.c_str()) <= 0)
+		{
+			printf("failed to load %s\n", indexname.c_str());
+			return 1;
+		}
+
+		THEORAPLAYER_VideoFrame frame = {};
+		THEORAPLAYER_IoStats before, after;
+		player.GetIoStats(&before);
+		unsigned int seed = 12345;
+		int mismatches = 0;
+		double total = 0.0, worst = 0.0, fromstart = 0.0;
+		for(int i = 0; i < seeks; i++)
+		{
+			seed = seed * 1103515245 + 12345;
+			const unsigned int target = (seed >> 8) % (duration + 1);
+
+			const double start = Seconds();
+			int result = player.SeekToMs(target);
+			while(result > 0 && (result = player.GetVideoFrame(&frame)) == 0 && player.IsDecoding())
+				;
+			const double elapsed = Seconds() - start;
+			total += elapsed;
+			worst = std::max(worst, elapsed);
+			fromstart += linear * target / duration;
+
+			const size_t expect = std::lower_bound(times.begin(), times.end(), target) - times.begin();
+			if(result <= 0 || frame.playms != times[expect] || HashFrame(frame) != hashes[expect])
+			{
+				printf("  MISMATCH seeking to %u ms: got %u ms, expected %u ms\n", target, result > 0 ? frame.playms : 0, times[expect]);
+				mismatches++;
+			}
+		}
+		player.GetIoStats(&after);
+		player.FreeFrameData(&frame);
+
+		if(indexed)
+			printf("  with index (%ld bytes, built in %.1f ms):\n", FileBytes(indexname.c_str()), build * 1000.0);
+		else
+			printf("  bisecting:\n");
+		printf("    %d seeks: average %.2f ms, worst %.2f ms, decoding from the start would average %.2f ms\n",
+			seeks, total * 1000.0 / seeks, worst * 1000.0, fromstart * 1000.0 / seeks);
+		printf("    %.1f reads and %.0f KB per seek\n", (double)(after.reads - before.reads) / seeks,
+			(double)(after.bytesRead - before.bytesRead) / seeks / 1024.0);
+		printf("    landing frames: %s\n", mismatches ? "MISMATCH" : "identical");
+		failures += mismatches;
+	}
+	remove(indexname.c_str());
+	return failures ? 1 : 0;
+}
+
+//Io counters with the read size pinned at 4KB (the old fixed size) against the adaptive default
+static int BenchRead(int argc, char** argv)
+{
+	if(argc < 1)
+		return -1;
+	const char* filename = argv[0];
+
+	unsigned long long hashes[2] = {};
+	for(int adaptive = 0; adaptive <= 1; adaptive++)
+	{
+		TheoraPlayer player;
+		if(player.OpenDecode(filename, THEORAPLAYER_VIDFMT_IYUV) <= 0 || (!adaptive && player.SetMaxReadSize(4096) <= 0) || player.Prepare() <= 0)
+		{
+			printf("failed to decode %s\n", filename);
+			return 1;
+		}
+
+		THEORAPLAYER_VideoFrame frame = {};
+		int frames = 0;
+		hashes[adaptive] = 14695981039346656037ull;
+		const double start = Seconds();
+		while(player.IsDecoding())
+		{
+			const int result = player.GetVideoFrame(&frame);
+			if(result < 0)
+				return 1;
+			if(result == 0)
+				continue;
+			frames++;
+			hashes[adaptive] = (hashes[adaptive] ^ HashFrame(frame)) * 1099511628211ull;
+		}
+		const double elapsed = Seconds() - start;
+		player.FreeFrameData(&frame);
+
+		THEORAPLAYER_IoStats stats;
+		player.GetIoStats(&stats);
+		printf("  %-8s %7llu reads (%6.2f per frame), %llu bytes, final read size %u, io %.2f ms, total %.3f ms/frame\n",
+			adaptive ? "adaptive" : "fixed 4K", stats.reads, (double)stats.reads / frames, stats.bytesRead, stats.readSize,
+			stats.seconds * 1000.0, elapsed * 1000.0 / frames);
+	}
+	printf("  output: %s\n", hashes[0] == hashes[1] ? "identical" : "MISMATCH");
+	return hashes[0] == hashes[1] ? 0 : 1;
+}
+
+//Real time sped up by rate, standing in for a machine too slow to decode the file in real time
+struct BenchClock
+{
+	THEORAPLAYER_Clock clock;
+	double start;
+	double rate;
+};
+
+static unsigned int BenchClockNow(THEORAPLAYER_Clock* clock)
+{
+	const BenchClock* bench = (const BenchClock*)clock->userdata;
+	return (unsigned int)((Seconds() - bench->start) * 1000.0 * bench->rate);
+}
+
+//Async playback against a clock the decoder can't keep up with, showing the newest due frame the way Player.cpp does,
+//with and without the worker knowing the clock
+static int BenchSchedule(int argc, char** argv)
+{
+	const char* filename = argv[0];
+	const double rate = argc > 1 ? atof(argv[1]) : 4.0;
+	if(rate <= 0.0)
+		return -1;
+
+	for(int scheduled = 0; scheduled <= 1; scheduled++)
+	{
+		TheoraPlayer player;
+		if(player.OpenDecode(filename, THEORAPLAYER_VIDFMT_BGR) <= 0 || player.Prepare() <= 0)
+		{
+			printf("failed to decode %s\n", filename);
+			return 1;
+		}
+
+		BenchClock bench;
+		bench.clock.now = BenchClockNow;
+		bench.clock.userdata = &bench;
+		bench.rate = rate;
+		bench.start = Seconds();
+		if(player.StartAsync(4, scheduled ? &bench.clock : nullptr) <= 0)
+			return 1;
+
+		const THEORAPLAYER_VideoFrame* video = nullptr;
+		const THEORAPLAYER_VideoFrame* next = nullptr;
+		unsigned int shown = 0, skipped = 0, stale = 0;
+		while(next || player.IsDecoding())
+		{
+			if(!next && player.TryAcquireFrame(&next) < 0)
+				return 1;
+			if(!next || next->playms > BenchClockNow(&bench.clock))
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				continue;
+			}
+			if(video)
+				player.ReleaseFrame(video);
+			video = next;
+			next = nullptr;
+			//on screen until the next frame is due; anything already queued behind it is stale
+			while(player.TryAcquireFrame(&next) > 0 && next->playms <= BenchClockNow(&bench.clock))
+			{
+				player.ReleaseFrame(video);
+				skipped++;
+				video = next;
+				next = nullptr;
+			}
+			shown++;
+			//already due to be replaced by the time it got on screen
+			if(video->fps > 0.0 && BenchClockNow(&bench.clock) >= video->playms + 1000.0 / video->fps)
+				stale++;
+		}
+		const double elapsed = Seconds() - bench.start;
+		if(video)
+			player.ReleaseFrame(video);
+
+		THEORAPLAYER_AsyncStats stats;
+		player.GetAsyncStats(&stats);
+		player.StopAsync();
+		printf("%s at %.1fx, %s:\n", filename, rate, scheduled ? "worker follows the clock" : "worker converts every frame");
+		printf("  %.1f ms, %u frames shown (%u more than a frame late), %u converted and skipped by the consumer, %u dropped unconverted by the worker\n",
+			elapsed * 1000.0, shown, stale, skipped, stats.framesDropped);
+		if(scheduled)
+			printf("  worker queued %u frames on time and %u late\n", stats.framesOnTime, stats.framesLate);
+	}
+	return 0;
+}
+
+//Cost of a skipped frame against a converted one, showing every nth frame and checking each shown frame
+//against a straight decode of the file
+static int BenchSkip(int argc, char** argv)
+{
+	const char* filename = argv[0];
+	const int every = argc > 1 ? std::max(atoi(argv[1]), 1) : 4;
+
+	int failures = 0;
+	printf("%s, showing every %d frames\n", filename, every);
+	for(auto format : { THEORAPLAYER_VIDFMT_IYUV, THEORAPLAYER_VIDFMT_BGRA })
+	{
+		std::vector<unsigned long long> hashes;
+		double decoded = 0.0, shown = 0.0, skipped = 0.0;
+		int showncount = 0, skippedcount = 0, mismatches = 0;
+		// pass 0 decodes everything for the reference, pass 1 skips all but every nth frame
+		for(int pass = 0; pass < 2; pass++)
+		{
+			TheoraPlayer player;
+			if(player.OpenDecode(filename, format) <= 0 || player.Prepare() <= 0)
+			{
+				printf("failed to open %s\n", filename);
+				return 1;
+			}
+			THEORAPLAYER_VideoFrame frame = {};
+			size_t index = 0;
+			while(player.IsDecoding())
+			{
+				const bool show = pass == 0 || index % every == 0;
+				const double start = Seconds();
+				const int result = show ? player.GetVideoFrame(&frame) : player.SkipVideoFrame();
+				const double seconds = Seconds() - start;
+				if(result < 0)
+				{
+					printf("failed to decode %s\n", filename);
+					return 1;
+				}
+				if(result == 0)
+					continue;
+
+				if(pass == 0)
+				{
+					decoded += seconds;
+					hashes.push_back(HashFrame(frame));
+				}
+				else if(show)
+				{
+					shown += seconds;
+					showncount++;
+					mismatches += index >= hashes.size() || HashFrame(frame) != hashes[index];
+				}
+				else
+				{
+					skipped += seconds;
+					skippedcount++;
+				}
+				index++;
+			}
+			player.FreeFrameData(&frame);
+		}
+
+		failures += mismatches;
+		printf("  %-5s decoded %7.3f ms/frame  shown %7.3f ms/frame  skipped %7.3f ms/frame  (%d shown, %d skipped)  %s\n",
+			FormatName(format), decoded * 1000.0 / std::max(hashes.size(), (size_t)1), shown * 1000.0 / std::max(showncount, 1),
+			skipped * 1000.0 / std::max(skippedcount, 1), showncount, skippedcount, mismatches ? "MISMATCH" : "identical");
+	}
+	return failures ? 1 : 0;
+}
+
+//Decode cost of each post-processing level, then the levels the adaptive controller settles on,
+//optionally with busy threads competing for the CPU
+static int BenchPostProcessing(int argc, char** argv)
+{
+	const char* filename = argv[0];
+	const int load = argc > 1 ? atoi(argv[1]) : 0;
+
+	printf("%s, IYUV output\n", filename);
+	unsigned long long reference = 0;
+	for(int level = 0; level <= 7; level++)
+	{
+		TheoraPlayer player;
+		if(player.OpenDecode(filename, THEORAPLAYER_VIDFMT_IYUV) <= 0 || player.SetPostProcessingLevel(level) <= 0 || player.Prepare() <= 0)
+		{
+			printf("failed to open %s\n", filename);
+			return 1;
+		}
+		THEORAPLAYER_VideoFrame frame = {};
+		unsigned long long hash = 14695981039346656037ull;
+		int frames = 0;
+		const double start = Seconds();
+		while(player.IsDecoding())
+		{
+			const int result = player.GetVideoFrame(&frame);
+			if(result < 0)
+				return 1;
+			if(result > 0)
+			{
+				frames++;
+				hash = (hash ^ HashFrame(frame)) * 1099511628211ull;
+			}
+		}
+		const double seconds = Seconds() - start;
+		player.FreeFrameData(&frame);
+		if(level == 0)
+			reference = hash;
+		printf("  level %d (using %d): %7.3f ms/frame%s\n", level, player.GetPostProcessingLevel(), seconds * 1000.0 / std::max(frames, 1),
+			(level > 0 && hash == reference) ? ", same pixels as level 0" : "");
+	}
+
+	std::atomic<bool> quit{ false };
+	std::vector<std::thread> busy;
+	for(int i = 0; i < load; i++)
+		busy.emplace_back([&quit] { while(!quit) {} });
+
+	TheoraPlayer player;
+	if(player.OpenDecode(filename, THEORAPLAYER_VIDFMT_IYUV) <= 0 || player.EnableAdaptivePostProcessing(7) <= 0 || player.Prepare() <= 0)
+		return 1;
+	THEORAPLAYER_VideoFrame frame = {};
+	int frames = 0, changes = 0, last = player.GetPostProcessingLevel();
+	int levels[8] = {};
+	double seconds = 0.0;
+	while(player.IsDecoding())
+	{
+		const double start = Seconds();
+		const int result = player.GetVideoFrame(&frame);
+		seconds += Seconds() - start;
+		if(result < 0)
+			break;
+		if(result == 0)
+			continue;
+		const int level = player.GetPostProcessingLevel();
+		frames++;
+		levels[level & 7]++;
+		changes += level != last;
+		last = level;
+	}
+	quit = true;
+	for(auto& thread : busy)
+		thread.join();
+	player.FreeFrameData(&frame);
+
+	printf("adaptive, %d busy threads: %7.3f ms/frame against a %.1f ms budget, %d level changes\n ", load,
+		seconds * 1000.0 / std::max(frames, 1), frame.fps > 0.0 ? 1000.0 / frame.fps : 0.0, changes);
+	for(int level = 0; level <= 7; level++)
+		printf(" %d:%d", level, levels[level]);
+	printf(" frames per level\n");
+	return 0;
+}
+
+//Resident set size in KB, or 0 where it can't be read
+static long ResidentKB()
+{
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return (long)(counters.WorkingSetSize / 1024);
+	return 0;
+#else
+	FILE* f = fopen("/proc/self/statm", "r");
+	if(!f)
+		return 0;
+	long pages = 0, resident = 0;
+	const int n = fscanf(f, "%ld %ld", &pages, &resident);
+	fclose(f);
+	return n == 2 ? resident * (sysconf(_SC_PAGESIZE) / 1024) : 0;
+#endif
+}
+
+//Plays a file through several times, looping with SeekToMs(0), under each audio policy and watches the
+//resident size. Audio that is decoded but never read is the reference for what unbounded growth looks like;
+//every other policy has to stay within a fixed margin of where it was after the first second.
+static int BenchSoak(int argc, char** argv)
+{
+	const char* filename = argv[0];
+	const int loops = argc > 1 ? std::max(atoi(argv[1]), 1) : 3;
+	const long marginKB = 128;
+	struct Policy { const char* name; THEORAPLAYER_AudioPolicy policy; bool drain; };
+	const Policy policies[] = {
+		{ "discard", THEORAPLAYER_AUDIO_DISCARD, false },
+		{ "ignore", THEORAPLAYER_AUDIO_IGNORE, false },
+		{ "decode and read", THEORAPLAYER_AUDIO_DECODE, true },
+		{ "decode, never read", THEORAPLAYER_AUDIO_DECODE, false },
+	};
+
+	if(!ResidentKB())
+	{
+		printf("can't read the resident size on this platform\n");
+		return 1;
+	}
+	printf("%s, %d loops\n", filename, loops);
+	int failures = 0;
+	int length = 0;  // video frames in one pass; with unread audio IsDecoding never goes false
+	std::vector<float> samples(4096 * 8);  // room for 4096 frames of up to 8 channels
+	for(const auto& policy : policies)
+	{
+		TheoraPlayer player;
+		if(player.OpenDecode(filename, THEORAPLAYER_VIDFMT_IYUV) <= 0 || player.SetAudioPolicy(policy.policy) <= 0 || player.Prepare() <= 0)
+		{
+			printf("failed to open %s\n", filename);
+			return 1;
+		}
+		long start = 0, peak = 0;
+		int frames = 0;
+		for(int loop = 0; loop < loops; loop++)
+		{
+			if(loop && player.SeekToMs(0) <= 0)
+			{
+				printf("failed to loop %s\n", filename);
+				return 1;
+			}
+			int passframes = 0;
+			while(player.IsDecoding() && (!length || passframes < length))
+			{
+				const int result = player.SkipVideoFrame();
+				if(result < 0)
+				{
+					printf("failed to decode %s\n", filename);
+					return 1;
+				}
+				while(policy.drain && player.ReadAudio(samples.data(), (int)samples.size() / 8) > 0)
+					;
+				if(result == 0)
+					continue;
+				passframes++;
+				if(++frames % 30)
+					continue;
+				const long resident = ResidentKB();
+				if(!start)
+					start = resident;
+				peak = std::max(peak, resident);
+			}
+			if(!length)
+				length = passframes;
+		}
+
+		const bool bounded = peak - start <= marginKB;
+		const bool checked = policy.drain || policy.policy != THEORAPLAYER_AUDIO_DECODE;
+		failures += checked && !bounded;
+		printf("  %-18s resident %6ld KB after 1s, peak %6ld KB, grew %6ld KB%s\n", policy.name, start, peak, peak - start,
+			checked ? (bounded ? "" : "  UNBOUNDED") : "  (reference)");
+	}
+	return failures ? 1 : 0;
+}
+
+//Lists the logical streams, then times a pass over the first Theora stream with the audio decoded,
+//discarded at the page, and never identified
+static int BenchStreams(int argc, char** argv)
+{
+	if(argc < 1)
+		return -1;
+	const char* filename = argv[0];
+	static const char* typenames[] = { "Theora", "Vorbis", "other" };
+
+	TheoraPlayer lister;
+	THEORAPLAYER_StreamInfo streams[16];
+	int count;
+	if(lister.OpenDecode(filename, THEORAPLAYER_VIDFMT_IYUV) <= 0 || (count = lister.ListStreams(streams, 16)) < 0)
+	{
+		printf("failed to open %s\n", filename);
+		return 1;
+	}
+	printf("%s, %d streams\n", filename, count);
+	for(int i = 0; i < std::min(count, 16); i++)
+	{
+		const THEORAPLAYER_StreamInfo& info = streams[i];
+		printf("  serial %11d  %-6s", info.serialno, typenames[info.type]);
+		if(info.type == THEORAPLAYER_STREAM_THEORA)
+			printf("  %ux%u at %.2f fps", info.width, info.height, info.fps);
+		else if(info.type == THEORAPLAYER_STREAM_VORBIS)
+			printf("  %d channels at %d Hz", info.channels, info.freq);
+		printf("\n");
+	}
+
+	const THEORAPLAYER_AudioPolicy policies[] = { THEORAPLAYER_AUDIO_DECODE, THEORAPLAYER_AUDIO_DISCARD, THEORAPLAYER_AUDIO_IGNORE };
+	const char* policynames[] = { "decode", "discard", "ignore" };
+	std::vector<float> samples(4096 * 8);
+	for(int i = 0; i < 3; i++)
+	{
+		TheoraPlayer player;
+		if(player.OpenDecode(filename, THEORAPLAYER_VIDFMT_IYUV) <= 0 || player.SetAudioPolicy(policies[i]) <= 0)
+			return 1;
+		const double start = Seconds();
+		if(player.Prepare() <= 0)
+		{
+			printf("failed to prepare %s\n", filename);
+			return 1;
+		}
+		int frames = 0;
+		while(player.IsDecoding())
+		{
+			const int result = player.SkipVideoFrame();
+			if(result < 0)
+				return 1;
+			frames += result;
+			while(player.ReadAudio(samples.data(), (int)samples.size() / 8) > 0)
+				;
+		}
+		printf("  audio %-7s %5d frames skipped in %8.1f ms\n", policynames[i], frames, (Seconds() - start) * 1000.0);
+	}
+	return 0;
+}
+
+//Checksums random pages of a few body sizes with each of libogg's CRC engines, checking they agree
+//with the byte-at-a-time engine
+static int BenchCrc(int argc, char** argv)
+{
+	const double megabytes = argc > 0 ? std::max(atof(argv[0]), 1.0) : 256.0;
+	const int engines[] = { OGG_CRC_BYTEWISE, OGG_CRC_SLICE8, OGG_CRC_PCLMUL };
+	const char* enginenames[] = { "bytewise", "slice8", "pclmul" };
+	const long bodysizes[] = { 255, 4096, 65025 };
+	const int pagecount = 16;
+
+	printf("libogg picks the %s CRC engine on this machine\n", enginenames[ogg_crc_engine_current() - 1]);
+	for(long bodysize : bodysizes)
+	{
+		std::vector<unsigned char> data((27 + 255 + bodysize) * pagecount);
+		for(size_t i = 0; i < data.size(); i++)
+			data[i] = (unsigned char)rand();
+		std::vector<ogg_page> pages(pagecount);
+		for(int i = 0; i < pagecount; i++)
+		{
+			pages[i].header = &data[i * (27 + 255 + bodysize)];
+			pages[i].header_len = 27 + 255;
+			pages[i].body = pages[i].header + pages[i].header_len;
+			pages[i].body_len = bodysize;
+		}
+		const long passes = std::max((long)(megabytes * 1048576.0 / (double)data.size()), 1L);
+
+		unsigned int reference[pagecount] = {};
+		for(int e = 0; e < 3; e++)
+		{
+			if(ogg_crc_engine(engines[e]) < 0)
+			{
+				printf("  %5ld byte pages  %-8s  not available\n", bodysize, enginenames[e]);
+				continue;
+			}
+			const double start = Seconds();
+			for(long pass = 0; pass < passes; pass++)
+			{
+				for(int i = 0; i < pagecount; i++)
+					ogg_page_checksum_set(&pages[i]);
+			}
+			const double seconds = Seconds() - start;
+
+			bool match = true;
+			for(int i = 0; i < pagecount; i++)
+			{
+				const unsigned char* crc = pages[i].header + 22;
+				const unsigned int value = crc[0] | (crc[1] << 8) | (crc[2] << 16) | ((unsigned int)crc[3] << 24);
+				if(e == 0)
+					reference[i] = value;
+				match = match && value == reference[i];
+			}
+			printf("  %5ld byte pages  %-8s  %8.1f MB/s%s\n", bodysize, enginenames[e],
+				(double)passes * (double)data.size() / 1048576.0 / seconds, match ? "" : "  MISMATCH");
+			if(!match)
+				return 1;
+		}
+	}
+	ogg_crc_engine(OGG_CRC_AUTO);
+	return 0;
+}
+
+static bool LoadFile(const char* filename, std::vector<unsigned char>& file)
+{
+	FILE* f = fopen(filename, "rb");
+	if(!f)
+		return false;
+	unsigned char chunk[65536];
+	size_t bytes;
+	while((bytes = fread(chunk, 1, sizeof(chunk), f)) > 0)
+		file.insert(file.end(), chunk, chunk + bytes);
+	fclose(f);
+	return true;
+}
+
+//Frames every page of a file held in memory and pulls every packet out of its stream, feeding the sync
+//buffer in 64K copies as the stdio path does
+static double DemuxFile(const std::vector<unsigned char>& file, bool trusted, int passes, long& pages, long& packets)
+{
+	const double start = Seconds();
+	for(int pass = 0; pass < passes; pass++)
+	{
+		ogg_sync_state sync;
+		ogg_sync_init(&sync);
+		ogg_sync_trusted(&sync, trusted);
+		std::vector<ogg_stream_state> streams;
+		ogg_page page;
+		ogg_packet packet;
+		pages = packets = 0;
+		for(size_t offset = 0; offset < file.size();)
+		{
+			const size_t bytes = std::min(file.size() - offset, (size_t)65536);
+			memcpy(ogg_sync_buffer(&sync, (long)bytes), &file[offset], bytes);
+			ogg_sync_wrote(&sync, (long)bytes);
+			offset += bytes;
+			while(ogg_sync_pageout(&sync, &page) == 1)
+			{
+				pages++;
+				const int serialno = ogg_page_serialno(&page);
+				size_t s = 0;
+				while(s < streams.size() && streams[s].serialno != serialno)
+					s++;
+				if(s == streams.size())
+				{
+					streams.emplace_back();
+					ogg_stream_init(&streams.back(), serialno);
+				}
+				ogg_stream_pagein(&streams[s], &page);
+				while(ogg_stream_packetout(&streams[s], &packet) == 1)
+					packets++;
+			}
+		}
+		for(ogg_stream_state& stream : streams)
+			ogg_stream_clear(&stream);
+		ogg_sync_clear(&sync);
+	}
+	return Seconds() - start;
+}
+
+//Demux cost per GB with page CRCs verified (by the old bytewise engine and the default one) and skipped
+//with THEORAPLAYER_OPEN_TRUSTED, then a full decode both ways to check the output doesn't change
+static int BenchDemux(int argc, char** argv)
+{
+	const char* filename = argv[0];
+	const int passes = argc > 1 ? std::max(atoi(argv[1]), 1) : 20;
+
+	std::vector<unsigned char> file;
+	if(!LoadFile(filename, file))
+	{
+		printf("failed to open %s\n", filename);
+		return 1;
+	}
+
+	const double gigabytes = (double)file.size() * passes / (1024.0 * 1024.0 * 1024.0);
+	const struct { const char* name; int engine; bool trusted; } modes[] = {
+		{ "verified, bytewise CRC", OGG_CRC_BYTEWISE, false },
+		{ "verified", OGG_CRC_AUTO, false },
+		{ "trusted", OGG_CRC_AUTO, true },
+	};
+	printf("%s, %zu bytes x %d passes\n", filename, file.size(), passes);
+	long expectpages = -1, expectpackets = -1;
+	for(const auto& mode : modes)
+	{
+		long pages = 0, packets = 0;
+		ogg_crc_engine(mode.engine);
+		const double seconds = DemuxFile(file, mode.trusted, passes, pages, packets);
+		printf("  %-24s %6ld pages %7ld packets  %8.3f s/GB\n", mode.name, pages, packets, seconds / gigabytes);
+		if(expectpages < 0)
+		{
+			expectpages = pages;
+			expectpackets = packets;
+		}
+		else if(pages != expectpages || packets != expectpackets)
+		{
+			printf("  MISMATCH\n");
+			return 1;
+		}
+	}
+	ogg_crc_engine(OGG_CRC_AUTO);
+
+	unsigned long long hashes[2] = {};
+	for(int trusted = 0; trusted <= 1; trusted++)
+	{
+		TheoraPlayer player;
+		if(player.OpenDecode(filename, THEORAPLAYER_VIDFMT_IYUV, nullptr, trusted ? THEORAPLAYER_OPEN_TRUSTED : THEORAPLAYER_OPEN_DEFAULT) <= 0 ||
+			player.Prepare() <= 0)
+		{
+			printf("failed to decode %s\n", filename);
+			return 1;
+		}
+		THEORAPLAYER_VideoFrame frame = {};
+		hashes[trusted] = 14695981039346656037ull;
+		while(player.IsDecoding())
+		{
+			const int result = player.GetVideoFrame(&frame);
+			if(result < 0)
+				return 1;
+			if(result > 0)
+				hashes[trusted] = (hashes[trusted] ^ HashFrame(frame)) * 1099511628211ull;
+		}
+		player.FreeFrameData(&frame);
+	}
+	printf("  decode output: %s\n", hashes[0] == hashes[1] ? "identical" : "MISMATCH");
+	return hashes[0] == hashes[1] ? 0 : 1;
+}
+
+//Bytes libogg moves within its sync and stream buffers per second of video. The player's own count comes
+//from GetIoStats; then the file is demuxed from memory at several read sizes, counting what libogg moved
+//against what compacting on every ogg_sync_buffer and ogg_stream_pagein call (libogg's old behaviour)
+//would have: the unreturned bytes at each call, which don't depend on where in the buffer they sit.
+static int BenchCompact(int argc, char** argv)
+{
+	if(argc < 1)
+		return -1;
+	const char* filename = argv[0];
+	std::vector<unsigned char> file;
+	if(!LoadFile(filename, file))
+	{
+		printf("failed to open %s\n", filename);
+		return 1;
+	}
+
+	TheoraPlayer player;
+	if(player.OpenDecode(filename, THEORAPLAYER_VIDFMT_IYUV) <= 0 || player.Prepare() <= 0)
+	{
+		printf("failed to decode %s\n", filename);
+		return 1;
+	}
+	THEORAPLAYER_PlanarFrame frame = {};
+	int frames = 0;
+	double fps = 0.0;
+	while(player.IsDecoding())
+	{
+		const int result = player.GetPlanarFrame(&frame);
+		if(result < 0)
+			return 1;
+		if(result > 0)
+		{
+			fps = frame.fps;
+			frames++;
+		}
+	}
+	if(!frames || fps <= 0.0)
+		return 1;
+	const double seconds = frames / fps;
+	THEORAPLAYER_IoStats stats;
+	player.GetIoStats(&stats);
+	printf("%s, %.1f seconds of video, %.1f KB/s\n", filename, seconds, file.size() / 1024.0 / seconds);
+	printf("  player, read size %6u         moved %8.1f KB/s\n", stats.readSize, stats.bytesCompacted / 1024.0 / seconds);
+
+	const size_t lacingbytes = sizeof(int) + sizeof(ogg_int64_t);
+	for(size_t readsize = 4096; readsize <= 256 * 1024; readsize *= 4)
+	{
+		unsigned long long eager = 0;
+		ogg_sync_state sync;
+		ogg_sync_init(&sync);
+		std::vector<ogg_stream_state> streams;
+		ogg_page page;
+		ogg_packet packet;
+		for(size_t offset = 0; offset < file.size();)
+		{
+			if(sync.returned)
+				eager += sync.fill - sync.returned;
+			const size_t bytes = std::min(file.size() - offset, readsize);
+			memcpy(ogg_sync_buffer(&sync, (long)bytes), &file[offset], bytes);
+			ogg_sync_wrote(&sync, (long)bytes);
+			offset += bytes;
+			while(ogg_sync_pageout(&sync, &page) == 1)
+			{
+				const int serialno = ogg_page_serialno(&page);
+				size_t s = 0;
+				while(s < streams.size() && streams[s].serialno != serialno)
+					s++;
+				if(s == streams.size())
+				{
+					streams.emplace_back();
+					ogg_stream_init(&streams.back(), serialno);
+				}
+				ogg_stream_state& stream = streams[s];
+				if(stream.body_returned)
+					eager += stream.body_fill - stream.body_returned;
+				if(stream.lacing_returned)
+					eager += (stream.lacing_fill - stream.lacing_returned) * lacingbytes;
+				ogg_stream_pagein(&stream, &page);
+				while(ogg_stream_packetout(&stream, &packet) == 1)
+					;
+			}
+		}
+		unsigned long long moved = sync.compacted;
+		for(ogg_stream_state& stream : streams)
+		{
+			moved += stream.compacted;
+			ogg_stream_clear(&stream);
+		}
+		ogg_sync_clear(&sync);
+		printf("  demux, read size %6zu  eager %8.1f KB/s, moved %8.1f KB/s\n", readsize,
+			eager / 1024.0 / seconds, moved / 1024.0 / seconds);
+	}
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	if(argc >= 2 && !strcmp(argv[1], "convert"))
+		return BenchConvert(argc - 2, argv + 2);
+	if(argc >= 3 && !strcmp(argv[1], "stripes"))
+		return BenchStripes(argc - 2, argv + 2);
+	if(argc >= 3 && !strcmp(argv[1], "seek"))
+		return BenchSeek(argc - 2, argv + 2);
+	if(argc >= 3 && !strcmp(argv[1], "read"))
+		return BenchRead(argc - 2, argv + 2);
+	if(argc >= 3 && !strcmp(argv[1], "schedule"))
+		return BenchSchedule(argc - 2, argv + 2);
+	if(argc >= 3 && !strcmp(argv[1], "skip"))
+		return BenchSkip(argc - 2, argv + 2);
+	if(argc >= 3 && !strcmp(argv[1], "postproc"))
+		return BenchPostProcessing(argc - 2, argv + 2);
+	if(argc >= 3 && !strcmp(argv[1], "soak"))
+		return BenchSoak(argc - 2, argv + 2);
+	if(argc >= 3 && !strcmp(argv[1], "streams"))
+		return BenchStreams(argc - 2, argv + 2);
+	if(argc >= 2 && !strcmp(argv[1], "crc"))
+		return BenchCrc(argc - 2, argv + 2);
+	if(argc >= 3 && !strcmp(argv[1], "demux"))
+		return BenchDemux(argc - 2, argv + 2);
+	if(argc >= 3 && !strcmp(argv[1], "compact"))
+		return BenchCompact(argc - 2, argv + 2);
+
+	printf("usage: %s convert [width height iterations]\n", argv[0]);
+	printf("       %s stripes file.ogv [iterations]\n", argv[0]);
+	printf("       %s seek file.ogv [seeks]\n", argv[0]);
+	printf("       %s read file.ogv\n", argv[0]);
+	printf("       %s schedule file.ogv [rate]\n", argv[0]);
+	printf("       %s skip file.ogv [every]\n", argv[0]);
+	printf("       %s postproc file.ogv [busythreads]\n", argv[0]);
+	printf("       %s soak file.ogv [loops]\n", argv[0]);
+	printf("       %s streams file.ogv\n", argv[0]);
+	printf("       %s crc [megabytes]\n", argv[0]);
+	printf("       %s demux file.ogv [passes]\n", argv[0]);
+	printf("       %s compact file.ogv\n", argv[0]);
+	return 1;
+}
@@ -0,0 +1,363 @@
+// Copyright (c) Promit Roy.
+// All rights reserved.
+//
+// This code is licensed under the MIT License.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "ColorConvert.h"
+
+#include <cstring>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define THEORAPLAYER_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#if defined(THEORAPLAYER_X86) && !defined(_MSC_VER)
+//GCC and clang refuse to emit intrinsics for instruction sets that weren't enabled on the command line,
+//unless the function is explicitly tagged with the target.
+#define THEORAPLAYER_TARGET_SSE2 __attribute__((target("sse2")))
+#define THEORAPLAYER_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define THEORAPLAYER_TARGET_SSE2
+#define THEORAPLAYER_TARGET_AVX2
+#endif
+
+// http://www.theora.org/doc/Theora.pdf, 1.1 spec,
+//  chapter 4.2 (Y'CbCr -> Y'PbPr -> R'G'B'), with kr = 0.299 and kb = 0.114.
+// The float math folds down to these coefficients, stored here with 13 fractional bits.
+// The arithmetic mirrors what SSE2 can do natively on 16 bit lanes: samples are placed in the high byte
+// of a 16 bit lane (chroma recentered around zero), multiplied keeping the high 16 bits of the product,
+// summed, and shifted down by 5 with rounding folded into the bias.
+static const int kY = 9539;     // 255 / 219
+static const int kCrR = 13075;  // 1.596
+static const int kCbG = -3209;  // -0.392
+static const int kCrG = -6660;  // -0.813
+static const int kCbB = 16525;  // 2.017
+static const int kBias = 16 - (((16 << 8) * kY) >> 16);  // rounding, minus the luma offset of 16
+
+static inline unsigned char ClampShift(int v)
+{
+	v >>= 5;
+	return (unsigned char)((v < 0) ? 0 : (v > 255) ? 255 : v);
+}
+
+// Scalar reference. RI and BI are the byte offsets of red and blue within a pixel.
+template<int RI, int BI, int BPP>
+static void ConvertRowScalar(const unsigned char* y, const unsigned char* cb, const unsigned char* cr, unsigned char* dst, int width)
+{
+	for(int x = 0; x < width; x++, dst += BPP)
+	{
+		const int yy = ((y[x] << 8) * kY) >> 16;
+		const int u = (cb[x >> 1] - 128) * 256;
+		const int v = (cr[x >> 1] - 128) * 256;
+		dst[RI] = ClampShift(yy + ((v * kCrR) >> 16) + kBias);
+		dst[1] = ClampShift(yy + ((u * kCbG) >> 16) + ((v * kCrG) >> 16) + kBias);
+		dst[BI] = ClampShift(yy + ((u * kCbB) >> 16) + kBias);
+		if(BPP == 4)
+			dst[3] = 0xFF;
+	}
+}
+
+#ifdef THEORAPLAYER_X86
+
+//The 24 bit stores write a little past the end of each block, so leave some pixels to the scalar tail.
+//Blocks are written in increasing address order, which means the spill is always overwritten afterwards.
+static const int kPackedSlack = 2;
+
+THEORAPLAYER_TARGET_SSE2 static inline void ConvertHalfSSE2(__m128i y16, __m128i u16, __m128i v16, __m128i& r, __m128i& g, __m128i& b)
+{
+	const __m128i bias = _mm_set1_epi16(kBias);
+	const __m128i yy = _mm_add_epi16(_mm_mulhi_epu16(y16, _mm_set1_epi16(kY)), bias);
+	r = _mm_srai_epi16(_mm_add_epi16(yy, _mm_mulhi_epi16(v16, _mm_set1_epi16(kCrR))), 5);
+	g = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(yy, _mm_mulhi_epi16(u16, _mm_set1_epi16(kCbG))), _mm_mulhi_epi16(v16, _mm_set1_epi16(kCrG))), 5);
+	b = _mm_srai_epi16(_mm_add_epi16(yy, _mm_mulhi_epi16(u16, _mm_set1_epi16(kCbB))), 5);
+}
+
+template<bool BGR, int BPP>
+THEORAPLAYER_TARGET_SSE2 static void ConvertRowSSE2(const unsigned char* y, const unsigned char* cb, const unsigned char* cr, unsigned char* dst, int width)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i sign = _mm_set1_epi16((short)0x8000);
+	const __m128i alpha = _mm_set1_epi8((char)0xFF);
+	const int slack = (BPP == 3) ? kPackedSlack : 0;
+
+	int x = 0;
+	for(; x + 16 + slack <= width; x += 16, dst += 16 * BPP)
+	{
+		const __m128i yv = _mm_loadu_si128((const __m128i*)(y + x));
+		__m128i cbv = _mm_loadl_epi64((const __m128i*)(cb + x / 2));
+		__m128i crv = _mm_loadl_epi64((const __m128i*)(cr + x / 2));
+		// 4:2:0 horizontal upsample by duplication, same as the scalar path
+		cbv = _mm_unpacklo_epi8(cbv, cbv);
+		crv = _mm_unpacklo_epi8(crv, crv);
+
+		__m128i rl, gl, bl, rh, gh, bh;
+		ConvertHalfSSE2(_mm_unpacklo_epi8(zero, yv), _mm_xor_si128(_mm_unpacklo_epi8(zero, cbv), sign),
+			_mm_xor_si128(_mm_unpacklo_epi8(zero, crv), sign), rl, gl, bl);
+		ConvertHalfSSE2(_mm_unpackhi_epi8(zero, yv), _mm_xor_si128(_mm_unpackhi_epi8(zero, cbv), sign),
+			_mm_xor_si128(_mm_unpackhi_epi8(zero, crv), sign), rh, gh, bh);
+		const __m128i r = _mm_packus_epi16(rl, rh);
+		const __m128i g = _mm_packus_epi16(gl, gh);
+		const __m128i b = _mm_packus_epi16(bl, bh);
+		const __m128i c0 = BGR ? b : r;
+		const __m128i c2 = BGR ? r : b;
+
+		const __m128i c01l = _mm_unpacklo_epi8(c0, g);
+		const __m128i c01h = _mm_unpackhi_epi8(c0, g);
+		const __m128i c23l = _mm_unpacklo_epi8(c2, alpha);
+		const __m128i c23h = _mm_unpackhi_epi8(c2, alpha);
+		__m128i px[4];
+		px[0] = _mm_unpacklo_epi16(c01l, c23l);
+		px[1] = _mm_unpackhi_epi16(c01l, c23l);
+		px[2] = _mm_unpacklo_epi16(c01h, c23h);
+		px[3] = _mm_unpackhi_epi16(c01h, c23h);
+
+		if(BPP == 4)
+		{
+			for(int i = 0; i < 4; i++)
+				_mm_storeu_si128((__m128i*)(dst + 16 * i), px[i]);
+		}
+		else
+		{
+			// no byte shuffle in SSE2; drop the 4th byte with overlapping 32 bit stores
+			for(int i = 0; i < 4; i++)
+			{
+				__m128i p = px[i];
+				for(int j = 0; j < 4; j++, p = _mm_srli_si128(p, 4))
+				{
+					const int v = _mm_cvtsi128_si32(p);
+					memcpy(dst + 3 * (4 * i + j), &v, 4);
+				}
+			}
+		}
+	}
+	ConvertRowScalar<BGR ? 2 : 0, BGR ? 0 : 2, BPP>(y + x, cb + x / 2, cr + x / 2, dst, width - x);
+}
+
+THEORAPLAYER_TARGET_AVX2 static inline void ConvertHalfAVX2(__m256i y16, __m256i u16, __m256i v16, __m256i& r, __m256i& g, __m256i& b)
+{
+	const __m256i bias = _mm256_set1_epi16(kBias);
+	const __m256i yy = _mm256_add_epi16(_mm256_mulhi_epu16(y16, _mm256_set1_epi16(kY)), bias);
+	r = _mm256_srai_epi16(_mm256_add_epi16(yy, _mm256_mulhi_epi16(v16, _mm256_set1_epi16(kCrR))), 5);
+	g = _mm256_srai_epi16(_mm256_add_epi16(_mm256_add_epi16(yy, _mm256_mulhi_epi16(u16, _mm256_set1_epi16(kCbG))), _mm256_mulhi_epi16(v16, _mm256_set1_epi16(kCrG))), 5);
+	b = _mm256_srai_epi16(_mm256_add_epi16(yy, _mm256_mulhi_epi16(u16, _mm256_set1_epi16(kCbB))), 5);
+}
+
+THEORAPLAYER_TARGET_AVX2 static inline __m256i LoadChromaAVX2(const unsigned char* c)
+{
+	const __m128i cv = _mm_loadu_si128((const __m128i*)c);
+	return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi8(cv, cv)), _mm_unpackhi_epi8(cv, cv), 1);
+}
+
+template<bool BGR, int BPP>
+THEORAPLAYER_TARGET_AVX2 static void ConvertRowAVX2(const unsigned char* y, const unsigned char* cb, const unsigned char* cr, unsigned char* dst, int width)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i sign = _mm256_set1_epi16((short)0x8000);
+	const __m256i alpha = _mm256_set1_epi8((char)0xFF);
+	// RGBX -> RGB within each 128 bit lane, leaving 12 valid bytes at the start of the lane
+	const __m256i pack24 = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+		0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	const int slack = (BPP == 3) ? kPackedSlack : 0;
+
+	int x = 0;
+	for(; x + 32 + slack <= width; x += 32, dst += 32 * BPP)
+	{
+		const __m256i yv = _mm256_loadu_si256((const __m256i*)(y + x));
+		const __m256i cbv = LoadChromaAVX2(cb + x / 2);
+		const __m256i crv = LoadChromaAVX2(cr + x / 2);
+
+		// unpack and pack both work within 128 bit lanes, so pixel order survives the round trip
+		__m256i rl, gl, bl, rh, gh, bh;
+		ConvertHalfAVX2(_mm256_unpacklo_epi8(zero, yv), _mm256_xor_si256(_mm256_unpacklo_epi8(zero, cbv), sign),
+			_mm256_xor_si256(_mm256_unpacklo_epi8(zero, crv), sign), rl, gl, bl);
+		ConvertHalfAVX2(_mm256_unpackhi_epi8(zero, yv), _mm256_xor_si256(_mm256_unpackhi_epi8(zero, cbv), sign),
+			_mm256_xor_si256(_mm256_unpackhi_epi8(zero, crv), sign), rh, gh, bh);
+		const __m256i r = _mm256_packus_epi16(rl, rh);
+		const __m256i g = _mm256_packus_epi16(gl, gh);
+		const __m256i b = _mm256_packus_epi16(bl, bh);
+		const __m256i c0 = BGR ? b : r;
+		const __m256i c2 = BGR ? r : b;
+
+		const __m256i c01l = _mm256_unpacklo_epi8(c0, g);
+		const __m256i c01h = _mm256_unpackhi_epi8(c0, g);
+		const __m256i c23l = _mm256_unpacklo_epi8(c2, alpha);
+		const __m256i c23h = _mm256_unpackhi_epi8(c2, alpha);
+		// lanes hold pixels {0-3, 16-19}, {4-7, 20-23}, {8-11, 24-27}, {12-15, 28-31}
+		const __m256i p0 = _mm256_unpacklo_epi16(c01l, c23l);
+		const __m256i p1 = _mm256_unpackhi_epi16(c01l, c23l);
+		const __m256i p2 = _mm256_unpacklo_epi16(c01h, c23h);
+		const __m256i p3 = _mm256_unpackhi_epi16(c01h, c23h);
+		__m256i px[4];
+		px[0] = _mm256_permute2x128_si256(p0, p1, 0x20);
+		px[1] = _mm256_permute2x128_si256(p2, p3, 0x20);
+		px[2] = _mm256_permute2x128_si256(p0, p1, 0x31);
+		px[3] = _mm256_permute2x128_si256(p2, p3, 0x31);
+
+		if(BPP == 4)
+		{
+			for(int i = 0; i < 4; i++)
+				_mm256_storeu_si256((__m256i*)(dst + 32 * i), px[i]);
+		}
+		else
+		{
+			for(int i = 0; i < 4; i++)
+			{
+				const __m256i p = _mm256_shuffle_epi8(px[i], pack24);
+				_mm_storeu_si128((__m128i*)(dst + 24 * i), _mm256_castsi256_si128(p));
+				_mm_storeu_si128((__m128i*)(dst + 24 * i + 12), _mm256_extracti128_si256(p, 1));
+			}
+		}
+	}
+	ConvertRowScalar<BGR ? 2 : 0, BGR ? 0 : 2, BPP>(y + x, cb + x / 2, cr + x / 2, dst, width - x);
+}
+
+static void CpuId(int leaf, int regs[4])
+{
+#if defined(_MSC_VER)
+	__cpuidex(regs, leaf, 0);
+#else
+	unsigned int a, b, c, d;
+	__cpuid_count(leaf, 0, a, b, c, d);
+	regs[0] = (int)a;
+	regs[1] = (int)b;
+	regs[2] = (int)c;
+	regs[3] = (int)d;
+#endif
+}
+
+static unsigned long long XGetBv()
+{
+#if defined(_MSC_VER)
+	return _xgetbv(0);
+#else
+	unsigned int lo, hi;
+	__asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	return ((unsigned long long)hi << 32) | lo;
+#endif
+}
+
+#endif //THEORAPLAYER_X86
+
+THEORAPLAYER_ConvertPath THEORAPLAYER_DetectConvertPath()
+{
+#ifdef THEORAPLAYER_X86
+	int regs[4];
+	CpuId(0, regs);
+	const int maxLeaf = regs[0];
+	CpuId(1, regs);
+	if(!(regs[3] & (1 << 26)))
+		return THEORAPLAYER_CVT_SCALAR;
+
+	//AVX2 needs the CPU feature bit and the OS saving YMM state (OSXSAVE + AVX, XCR0 bits 1 and 2)
+	const int osxsave_avx = (1 << 27) | (1 << 28);
+	if(maxLeaf >= 7 && (regs[2] & osxsave_avx) == osxsave_avx && (XGetBv() & 6) == 6)
+	{
+		CpuId(7, regs);
+		if(regs[1] & (1 << 5))
+			return THEORAPLAYER_CVT_AVX2;
+	}
+	return THEORAPLAYER_CVT_SSE2;
+#else
+	return THEORAPLAYER_CVT_SCALAR;
+#endif
+}
+
+THEORAPLAYER_ConvertRowFn THEORAPLAYER_GetConvertRowFn(THEORAPLAYER_VideoFormat format, THEORAPLAYER_ConvertPath path)
+{
+	static const THEORAPLAYER_ConvertPath best = THEORAPLAYER_DetectConvertPath();
+	if(path > best)
+		path = best;
+
+	switch(path)
+	{
+#ifdef THEORAPLAYER_X86
+	case THEORAPLAYER_CVT_AVX2:
+		switch(format)
+		{
+		case THEORAPLAYER_VIDFMT_RGB: return ConvertRowAVX2<false, 3>;
+		case THEORAPLAYER_VIDFMT_RGBA: return ConvertRowAVX2<false, 4>;
+		case THEORAPLAYER_VIDFMT_BGR: return ConvertRowAVX2<true, 3>;
+		case THEORAPLAYER_VIDFMT_BGRA: return ConvertRowAVX2<true, 4>;
+		default: return nullptr;
+		}
+	case THEORAPLAYER_CVT_SSE2:
+		switch(format)
+		{
+		case THEORAPLAYER_VIDFMT_RGB: return ConvertRowSSE2<false, 3>;
+		case THEORAPLAYER_VIDFMT_RGBA: return ConvertRowSSE2<false, 4>;
+		case THEORAPLAYER_VIDFMT_BGR: return ConvertRowSSE2<true, 3>;
+		case THEORAPLAYER_VIDFMT_BGRA: return ConvertRowSSE2<true, 4>;
+		default: return nullptr;
+		}
+#endif
+	default:
+		switch(format)
+		{
+		case THEORAPLAYER_VIDFMT_RGB: return ConvertRowScalar<0, 2, 3>;
+		case THEORAPLAYER_VIDFMT_RGBA: return ConvertRowScalar<0, 2, 4>;
+		case THEORAPLAYER_VIDFMT_BGR: return ConvertRowScalar<2, 0, 3>;
+		case THEORAPLAYER_VIDFMT_BGRA: return ConvertRowScalar<2, 0, 4>;
+		default: return nullptr;
+		}
+	}
+}
+
+int THEORAPLAYER_BytesPerPixel(THEORAPLAYER_VideoFormat format)
+{
+	switch(format)
+	{
+	case THEORAPLAYER_VIDFMT_RGB:
+	case THEORAPLAYER_VIDFMT_BGR:
+		return 3;
+	case THEORAPLAYER_VIDFMT_RGBA:
+	case THEORAPLAYER_VIDFMT_BGRA:
+		return 4;
+	default:
+		return 0;
+	}
+}
+
+void THEORAPLAYER_Convert420(THEORAPLAYER_ConvertRowFn rowfn,
+	const unsigned char* y, int ystride,
+	const unsigned char* cb, int cbstride,
+	const unsigned char* cr, int crstride,
+	int width, int height, unsigned char* dst, int dststride)
+{
+	for(int posy = 0; posy < height; posy++)
+	{
+		rowfn(y, cb, cr, dst, width);
+		y += ystride;
+		dst += dststride;
+		// adjust to the next chroma line every other row
+		if(posy & 1)
+		{
+			cb += cbstride;
+			cr += crstride;
+		}
+	}
+}
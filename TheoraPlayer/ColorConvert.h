@@ -0,0 +1,59 @@
+// Copyright (c) Promit Roy.
+// All rights reserved.
+//
+// This code is licensed under the MIT License.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+//Fixed-point YCbCr 4:2:0 to packed RGB conversion, shared by the player and the benchmark.
+//Scalar, SSE2 and AVX2 kernels all implement the exact same integer math, so output is
+//bit-identical regardless of which kernel the CPU ends up running.
+
+#ifndef THEORAPLAYER_COLORCONVERT_H
+#define THEORAPLAYER_COLORCONVERT_H
+#pragma once
+
+#include "TheoraPlayer.h"
+
+enum THEORAPLAYER_ConvertPath
+{
+	THEORAPLAYER_CVT_SCALAR,  /* portable C++ reference */
+	THEORAPLAYER_CVT_SSE2,    /* 16 pixels per iteration */
+	THEORAPLAYER_CVT_AVX2     /* 32 pixels per iteration */
+};
+
+//Converts one row of pixels. cb and cr point at the chroma row that covers this luma row.
+typedef void(*THEORAPLAYER_ConvertRowFn)(const unsigned char* y, const unsigned char* cb, const unsigned char* cr, unsigned char* dst, int width);
+
+//Best path supported by the running CPU and OS
+THEORAPLAYER_ConvertPath THEORAPLAYER_DetectConvertPath();
+//Row converter for a packed output format (RGB, RGBA, BGR, BGRA) on the given path, or nullptr.
+//Paths that are not compiled in or not supported by the CPU fall back to the next best one.
+THEORAPLAYER_ConvertRowFn THEORAPLAYER_GetConvertRowFn(THEORAPLAYER_VideoFormat format, THEORAPLAYER_ConvertPath path);
+//Bytes per pixel of a packed output format, 0 for planar formats
+int THEORAPLAYER_BytesPerPixel(THEORAPLAYER_VideoFormat format);
+
+//Convert a 4:2:0 image. The first row must be an even (chroma-aligned) row.
+void THEORAPLAYER_Convert420(THEORAPLAYER_ConvertRowFn rowfn,
+	const unsigned char* y, int ystride,
+	const unsigned char* cb, int cbstride,
+	const unsigned char* cr, int crstride,
+	int width, int height, unsigned char* dst, int dststride);
+
+#endif
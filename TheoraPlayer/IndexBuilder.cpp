@@ -0,0 +1,57 @@
+// Copyright (c) Promit Roy.
+// All rights reserved.
+//
+// This code is licensed under the MIT License.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+//Command line tool that writes a seek index for each Ogg Theora file it is given, as file.ogv.seekidx
+//beside it, for TheoraPlayer::LoadSeekIndex. Build this file together with TheoraPlayer.cpp, ColorConvert.cpp,
+//SeekIndex.cpp and the codec libraries, in place of Player.cpp.
+//
+//  IndexBuilder file.ogv...
+
+#include <cstdio>
+#include <string>
+#include "TheoraPlayer.h"
+
+int main(int argc, char** argv)
+{
+	if(argc < 2)
+	{
+		printf("usage: %s file.ogv...\n", argv[0]);
+		return 1;
+	}
+
+	int failures = 0;
+	for(int i = 1; i < argc; i++)
+	{
+		const std::string indexname = std::string(argv[i]) + ".seekidx";
+		if(THEORAPLAYER_BuildSeekIndex(argv[i], indexname.c_str()) > 0)
+		{
+			printf("%s -> %s\n", argv[i], indexname.c_str());
+		}
+		else
+		{
+			printf("failed to index %s\n", argv[i]);
+			failures++;
+		}
+	}
+	return failures ? 1 : 0;
+}
@@ -74,21 +74,37 @@ static int setup() {
 	return 0;
 }
 
-static GLuint texture;
-static void gen_texture(const THEORAPLAYER_VideoFrame *video) {
-	glEnable(GL_TEXTURE_2D);
-	//generate texture
-	glGenTextures(1, &texture);
-	glBindTexture(GL_TEXTURE_2D, texture);
-	unsigned char* rgb = video->pixels;
-
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-	// Load and generate the texture
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, video->width, video->height, 0, GL_BGR, GL_UNSIGNED_BYTE, rgb);
+//Y, Cb and Cr textures, made once for the video size and updated in place every frame
+static GLuint textures[3];
+static unsigned int texturewidth = 0, textureheight = 0;
+static void upload_planes(const THEORAPLAYER_PlanarFrame *planar) {
+	if(planar->width != texturewidth || planar->height != textureheight)
+	{
+		if(texturewidth)
+			glDeleteTextures(3, textures);
+		glGenTextures(3, textures);
+		for(int p = 0; p < 3; p++)
+		{
+			glBindTexture(GL_TEXTURE_2D, textures[p]);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, p ? planar->width / 2 : planar->width, p ? planar->height / 2 : planar->height, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+		}
+		texturewidth = planar->width;
+		textureheight = planar->height;
+	}
+
+	// one byte per texel, rows as far apart as the plane's stride, so each plane goes up without repacking
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for(int p = 0; p < 3; p++)
+	{
+		glBindTexture(GL_TEXTURE_2D, textures[p]);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, planar->strides[p]);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, p ? planar->width / 2 : planar->width, p ? planar->height / 2 : planar->height, GL_RED, GL_UNSIGNED_BYTE, planar->planes[p]);
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 	glBindTexture(GL_TEXTURE_2D, 0);
 }
 
@@ -100,6 +116,11 @@ static long long getTime() {
 	return ms.count();
 }
 
+//Playback position for the decoder's scheduler
+static unsigned int clockNow(THEORAPLAYER_Clock *clock) {
+	return (unsigned int)(getTime() - baseticks);
+}
+
 static GLuint setupBindings(Shader ourShader) {
 	GLfloat vertices[] = {
 		// Positions          // Colors           // Texture Coords
@@ -150,11 +171,16 @@ static void game_loop(Shader ourShader, const THEORAPLAYER_VideoFrame *video, GL
 	glClear(GL_COLOR_BUFFER_BIT); // clears the entire buffer (can be color, depth, and/or stencil)
 								  // Draw traingle
 								  //glUseProgram(ourShader);
-	if(video)
-		gen_texture(video);
+	THEORAPLAYER_PlanarFrame planar;
+	if(video && THEORAPLAYER_GetFramePlanes(video, &planar) > 0)
+		upload_planes(&planar);
 
 	ourShader.Use();
-	glBindTexture(GL_TEXTURE_2D, texture);
+	for(int p = 0; p < 3; p++)
+	{
+		glActiveTexture(GL_TEXTURE0 + p);
+		glBindTexture(GL_TEXTURE_2D, textures[p]);
+	}
 	glBindVertexArray(VAO);
 	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
 	glBindVertexArray(0);
@@ -172,18 +198,26 @@ static void playfile(const char *fname)
 	if(setup() != 0) {
 		return;
 	}
-	Shader ourShader("texture.vs", "texture.frag");
+	//The shader converts to RGB, so the frames stay in Y'CbCr: half the bytes of RGB to upload, and no conversion on the CPU
+	Shader ourShader("texture.vs", "yuv.frag");
+	ourShader.Use();
+	glUniform1i(glGetUniformLocation(ourShader.Program, "planeY"), 0);
+	glUniform1i(glGetUniformLocation(ourShader.Program, "planeCb"), 1);
+	glUniform1i(glGetUniformLocation(ourShader.Program, "planeCr"), 2);
 	GLuint VAO = setupBindings(ourShader);
 
 	printf("Trying file '%s' ...\n", fname);
 
-	auto result = player.OpenDecode(fname, THEORAPLAYER_VIDFMT_BGR);
+	auto result = player.OpenDecode(fname, THEORAPLAYER_VIDFMT_IYUV);
 	if(!result)
 	{
 		printf("Failed to open decoding '%s'!\n", fname);
 		return;
 	} // if
 
+	//Deblock and dering as much as the machine has time for
+	player.EnableAdaptivePostProcessing(7);
+
 	result = player.Prepare();
 	if(!result)
 	{
@@ -191,42 +225,68 @@ static void playfile(const char *fname)
 		return;
 	}
 
-	THEORAPLAYER_VideoFrame* video = new THEORAPLAYER_VideoFrame();
-	player.GetVideoFrame(video);
-	const unsigned int framems = (video->fps == 0.0) ? 0 : ((GLuint)(1000.0 / video->fps));
+	//Decode on a worker thread, so a slow keyframe doesn't stall rendering. The worker has to copy each picture
+	//out of the decoder to queue it; a renderer that decodes on its own thread can upload GetPlanarFrame's views instead.
+	//The clock lets it drop frames we'd be too late to show without converting them.
+	THEORAPLAYER_Clock clock = { clockNow, nullptr };
+	baseticks = getTime();
+	result = player.StartAsync(4, &clock);
+	if(result <= 0)
+	{
+		printf("Failed to start decoding thread.\n");
+		return;
+	}
+
 	if(!window)
 	{
 		std::cout << "ERROR" << std::endl;
 	}
 
-	baseticks = getTime();
-	while(!quit && player.IsDecoding())
+	const THEORAPLAYER_VideoFrame* video = nullptr;  // on screen
+	const THEORAPLAYER_VideoFrame* next = nullptr;  // decoded, waiting for its time
+	unsigned int framems = 0;
+	while(!quit && (next || player.IsDecoding()))
 	{
 		const long long now = getTime() - baseticks;
 
+		// Never waits on the decoder; if nothing is ready we just keep showing the current frame.
+		if(!next && player.TryAcquireFrame(&next) < 0)
+			break;
+
 		// Play video frames when it's time.
-		if (video->playms <= now)
+		if (next && next->playms <= now)
 		{
-			if (framems && ((now - video->playms) >= framems))
+			if (!framems && next->fps != 0.0)
+				framems = (unsigned int)(1000.0 / next->fps);
+			if (video)
+				player.ReleaseFrame(video);
+			video = next;
+			next = nullptr;
+
+			// Skip frames that were queued before we fell behind
+			while (framems && ((now - video->playms) >= framems) && player.TryAcquireFrame(&next) > 0)
 			{
-				// Skip frames to catch up
-				while (player.GetVideoFrame(video) >= 0)
-				{
-					if ((now - video->playms) < framems)
-						break;
-				} // while
-			} // if
+				player.ReleaseFrame(video);
+				video = next;
+				next = nullptr;
+			} // while
 
 			game_loop(ourShader, video, VAO);
-			player.GetVideoFrame(video);
 		}
 		else
 		{
 			std::this_thread::sleep_for(1ms);
 		}
 	}
-	player.FreeFrameData(video);
-	delete video;
+	if (video)
+		player.ReleaseFrame(video);
+	if (next)
+		player.ReleaseFrame(next);
+
+	THEORAPLAYER_AsyncStats stats;
+	if(player.GetAsyncStats(&stats) > 0)
+		printf("%u frames on time, %u late, %u dropped by the decoder\n", stats.framesOnTime, stats.framesLate, stats.framesDropped);
+	player.StopAsync();
 } // playfile
 
 int main(int argc, char **argv)
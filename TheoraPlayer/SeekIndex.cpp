@@ -0,0 +1,133 @@
+// Copyright (c) Promit Roy.
+// All rights reserved.
+//
+// This code is licensed under the MIT License.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "SeekIndex.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+static_assert(sizeof(THEORAPLAYER_SeekIndexHeader) == 32, "seek index header layout");
+static_assert(sizeof(THEORAPLAYER_SeekIndexEntry) == 16, "seek index entry layout");
+
+// The file is little-endian and read in place, so other hosts can't use it
+static int LittleEndianHost()
+{
+	const unsigned int one = 1;
+	unsigned char first;
+	memcpy(&first, &one, 1);
+	return first == 1;
+}
+
+int THEORAPLAYER_OpenSeekIndex(const void* data, size_t size, THEORAPLAYER_SeekIndexContainer container, long long filesize,
+	const THEORAPLAYER_SeekIndexEntry** entries, size_t* count)
+{
+	if(!data || !entries || !count || !LittleEndianHost())
+		return -1;
+	if(((uintptr_t)data & 7) || size < sizeof(THEORAPLAYER_SeekIndexHeader))
+		return -1;
+
+	const THEORAPLAYER_SeekIndexHeader* header = (const THEORAPLAYER_SeekIndexHeader*)data;
+	if(memcmp(header->magic, THEORAPLAYER_SEEKINDEX_MAGIC, sizeof(header->magic)) != 0)
+		return -1;
+	if(header->version != THEORAPLAYER_SEEKINDEX_VERSION || header->container != (unsigned int)container)
+		return -1;
+	if(filesize >= 0 && header->filesize != filesize)
+		return -1;
+	if(header->count == 0 || header->count > (size - sizeof(*header)) / sizeof(THEORAPLAYER_SeekIndexEntry))
+		return -1;
+
+	*entries = (const THEORAPLAYER_SeekIndexEntry*)(header + 1);
+	*count = header->count;
+	return 1;
+}
+
+const THEORAPLAYER_SeekIndexEntry* THEORAPLAYER_FindSeekIndexEntry(const THEORAPLAYER_SeekIndexEntry* entries, size_t count, long long time)
+{
+	// first entry after time, then step back one
+	size_t lo = 0;
+	size_t hi = count;
+	while(lo < hi)
+	{
+		const size_t mid = lo + (hi - lo) / 2;
+		if(entries[mid].time <= time)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return &entries[lo ? lo - 1 : 0];
+}
+
+int THEORAPLAYER_WriteSeekIndex(const char* filename, THEORAPLAYER_SeekIndexContainer container, long long filesize,
+	const THEORAPLAYER_SeekIndexEntry* entries, size_t count)
+{
+	if(!LittleEndianHost() || !count || count > UINT32_MAX)
+		return -1;
+
+	THEORAPLAYER_SeekIndexHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, THEORAPLAYER_SEEKINDEX_MAGIC, sizeof(header.magic));
+	header.version = THEORAPLAYER_SEEKINDEX_VERSION;
+	header.container = container;
+	header.filesize = filesize;
+	header.count = (unsigned int)count;
+
+	FILE* f = fopen(filename, "wb");
+	if(!f)
+		return -1;
+	const int ok = fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(entries, sizeof(*entries), count, f) == count;
+	// a short write leaves nothing the loader would accept, but don't leave it around either
+	if(fclose(f) != 0 || !ok)
+	{
+		remove(filename);
+		return -1;
+	}
+	return 1;
+}
+
+int THEORAPLAYER_ReadSeekIndex(const char* filename, unsigned char** data, size_t* size)
+{
+	FILE* f = fopen(filename, "rb");
+	if(!f)
+		return -1;
+	long length = -1;
+	if(fseek(f, 0, SEEK_END) == 0)
+		length = ftell(f);
+	if(length < (long)sizeof(THEORAPLAYER_SeekIndexHeader) || fseek(f, 0, SEEK_SET) != 0)
+	{
+		fclose(f);
+		return -1;
+	}
+
+	unsigned char* buffer = new unsigned char[length];
+	if(fread(buffer, 1, length, f) != (size_t)length)
+	{
+		delete[] buffer;
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	*data = buffer;
+	*size = (size_t)length;
+	return 1;
+}
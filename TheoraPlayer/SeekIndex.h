@@ -0,0 +1,76 @@
+// Copyright (c) Promit Roy.
+// All rights reserved.
+//
+// This code is licensed under the MIT License.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+//Seek index sidecar shared by TheoraPlayer and WebmPlayer. An index maps keyframe timestamps to the byte
+//offsets decoding can restart from, so a seek becomes a lookup and a single jump instead of a search of the file.
+//The file is a fixed header followed by an array of entries sorted by time, all little-endian and laid out
+//so a loaded or memory mapped index is used in place without parsing.
+
+#ifndef THEORAPLAYER_SEEKINDEX_H
+#define THEORAPLAYER_SEEKINDEX_H
+#pragma once
+
+#include <cstddef>
+
+#define THEORAPLAYER_SEEKINDEX_MAGIC "TPSEEKIX"
+#define THEORAPLAYER_SEEKINDEX_VERSION 1
+
+//What kind of media file an index was built from, which fixes the units of its entries
+enum THEORAPLAYER_SeekIndexContainer
+{
+	THEORAPLAYER_SEEKINDEX_OGG = 1,   /* time is a Theora frame number, offset is the page the keyframe packet starts on */
+	THEORAPLAYER_SEEKINDEX_WEBM = 2   /* time is in nanoseconds, offset is the start of the cluster holding the keyframe */
+};
+
+//32 bytes at the start of the file
+struct THEORAPLAYER_SeekIndexHeader
+{
+	char magic[8];
+	unsigned int version;
+	unsigned int container;
+	//Size of the media file the index describes, to catch an index that has gone stale
+	long long filesize;
+	unsigned int count;
+	unsigned int reserved;
+};
+
+//16 bytes per keyframe, following the header
+struct THEORAPLAYER_SeekIndexEntry
+{
+	long long time;
+	long long offset;
+};
+
+//Check an index held in memory against the media file it should describe, and point at its entries.
+//data must be 8 byte aligned, as malloc and mapped memory are. Returns 1 and the entries, or -1 if the index doesn't fit.
+int THEORAPLAYER_OpenSeekIndex(const void* data, size_t size, THEORAPLAYER_SeekIndexContainer container, long long filesize,
+	const THEORAPLAYER_SeekIndexEntry** entries, size_t* count);
+//The last entry at or before time, or the first entry if time comes before all of them. count must not be 0.
+const THEORAPLAYER_SeekIndexEntry* THEORAPLAYER_FindSeekIndexEntry(const THEORAPLAYER_SeekIndexEntry* entries, size_t count, long long time);
+//Write entries, sorted by time, to an index file. Returns 1 on success, -1 on failure.
+int THEORAPLAYER_WriteSeekIndex(const char* filename, THEORAPLAYER_SeekIndexContainer container, long long filesize,
+	const THEORAPLAYER_SeekIndexEntry* entries, size_t count);
+//Read a whole index file into memory allocated with new[], for THEORAPLAYER_OpenSeekIndex. Returns -1 if it can't be read.
+int THEORAPLAYER_ReadSeekIndex(const char* filename, unsigned char** data, size_t* size);
+
+#endif
@@ -24,30 +24,66 @@
 //This code is derived from Ryan C. Gordon's TheoraPlay:
 //https://www.icculus.org/theoraplay/
 //This is mostly a C++ rework, cleaned up for general ease of use, and with threading delegated to the caller
+//(StartAsync provides an optional decode thread for callers that do not want to manage their own)
 
 #include "TheoraPlayer.h"
+#include "ColorConvert.h"
+#include "SeekIndex.h"
 
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
 #include <cassert>
-#include <utility>
+#include <climits>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#if defined(_WIN32)
+#include <malloc.h>
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "theora/theoradec.h"
 #include "vorbis/codec.h"
 
 #define THEORAPLAY_INTERNAL 1
 
+// Bounds for the adaptive Ogg read size
+#define THEORAPLAYER_MIN_READ_SIZE 4096
+#define THEORAPLAYER_DEFAULT_MAX_READ_SIZE (256 * 1024)
+
+// stdio buffer for the built-in file Io, so small reads don't each become a syscall
+#define THEORAPLAYER_FILE_READAHEAD (64 * 1024)
+
+// Audio ring for THEORAPLAYER_AUDIO_DECODE picked without EnableAudio
+#define THEORAPLAYER_DEFAULT_AUDIO_BUFFER_MS 1000
+
+// Frames the adaptive post-processing controller waits at a level before raising it, and the most it backs off to
+#define THEORAPLAYER_PP_HOLD_FRAMES 30
+#define THEORAPLAYER_PP_MAX_HOLD_FRAMES 960
+
 typedef THEORAPLAYER_VideoFrame VideoFrame;
 typedef THEORAPLAYER_AudioPacket AudioPacket;
 
 // !!! FIXME: these all count on the pixel format being TH_PF_420 for now.
-typedef void (*ConvertVideoFrameFn)(const th_info *tinfo, const th_ycbcr_buffer ycbcr, unsigned char* pixels);
+// Converts picture rows [row0, row1) into the output. row0 must be even so chroma stays aligned.
+typedef void (*ConvertVideoFrameFn)(const th_info *tinfo, const th_ycbcr_buffer ycbcr, unsigned char* pixels, int row0, int row1);
 
-static void ConvertVideoFrame420ToYUVPlanar(const th_info *tinfo, const th_ycbcr_buffer ycbcr, const int p0, const int p1, const int p2, unsigned char* yuv)
+static void ConvertVideoFrame420ToYUVPlanar(const th_info *tinfo, const th_ycbcr_buffer ycbcr, const int p0, const int p1, const int p2, unsigned char* yuv, int row0, int row1)
 {
 	assert(tinfo);
 	assert(yuv);
+	assert((row0 & 1) == 0);
 
 	//output size is w * h * 2
 	int i;
@@ -57,110 +93,177 @@ static void ConvertVideoFrame420ToYUVPlanar(const th_info *tinfo, const th_ycbcr
 	const int uvoff = (tinfo->pic_x / 2) + (ycbcr[1].stride) * (tinfo->pic_y / 2);
 	if(yuv)
 	{
-		unsigned char *dst = yuv;
-		for(i = 0; i < h; i++, dst += w)
+		unsigned char *dst = yuv + w * row0;
+		for(i = row0; i < row1; i++, dst += w)
 			memcpy(dst, ycbcr[p0].data + yoff + ycbcr[p0].stride * i, w);
-		for(i = 0; i < (h / 2); i++, dst += w / 2)
+		dst = yuv + w * h + (w / 2) * (row0 / 2);
+		for(i = row0 / 2; i < (row1 / 2); i++, dst += w / 2)
 			memcpy(dst, ycbcr[p1].data + uvoff + ycbcr[p1].stride * i, w / 2);
-		for(i = 0; i < (h / 2); i++, dst += w / 2)
+		dst = yuv + w * h + (w / 2) * (h / 2) + (w / 2) * (row0 / 2);
+		for(i = row0 / 2; i < (row1 / 2); i++, dst += w / 2)
 			memcpy(dst, ycbcr[p2].data + uvoff + ycbcr[p2].stride * i, w / 2);
 	} // if
 } // ConvertVideoFrame420ToYUVPlanar
 
 
-static void ConvertVideoFrame420ToYV12(const th_info *tinfo, const th_ycbcr_buffer ycbcr, unsigned char* pixels)
+static void ConvertVideoFrame420ToYV12(const th_info *tinfo, const th_ycbcr_buffer ycbcr, unsigned char* pixels, int row0, int row1)
 {
-	return ConvertVideoFrame420ToYUVPlanar(tinfo, ycbcr, 0, 2, 1, pixels);
+	return ConvertVideoFrame420ToYUVPlanar(tinfo, ycbcr, 0, 2, 1, pixels, row0, row1);
 } // ConvertVideoFrame420ToYV12
 
 
-static void ConvertVideoFrame420ToIYUV(const th_info *tinfo, const th_ycbcr_buffer ycbcr, unsigned char* pixels)
+static void ConvertVideoFrame420ToIYUV(const th_info *tinfo, const th_ycbcr_buffer ycbcr, unsigned char* pixels, int row0, int row1)
 {
-	return ConvertVideoFrame420ToYUVPlanar(tinfo, ycbcr, 0, 1, 2, pixels);
+	return ConvertVideoFrame420ToYUVPlanar(tinfo, ycbcr, 0, 1, 2, pixels, row0, row1);
 } // ConvertVideoFrame420ToIYUV
 
-static void THEORAPLAY_CVT_420_RGB(const th_info *tinfo, const th_ycbcr_buffer ycbcr, unsigned char* pixels, THEORAPLAYER_VideoFormat format)
+static void THEORAPLAY_CVT_420_RGB(const th_info *tinfo, const th_ycbcr_buffer ycbcr, unsigned char* pixels, int row0, int row1, THEORAPLAYER_VideoFormat format, THEORAPLAYER_ConvertRowFn rowfn)
 {
 	assert(tinfo);
 	assert(pixels);
+	assert(rowfn);
+	assert((row0 & 1) == 0);
 
 	const int w = tinfo->pic_width;
-	const int h = tinfo->pic_height;
+	const int bpp = THEORAPLAYER_BytesPerPixel(format);
 
-	unsigned char *dst = pixels;
 	const int ystride = ycbcr[0].stride;
 	const int cbstride = ycbcr[1].stride;
 	const int crstride = ycbcr[2].stride;
-	const int yoff = (tinfo->pic_x & ~1) + ystride * (tinfo->pic_y & ~1);
-	const int cboff = (tinfo->pic_x / 2) + (cbstride) * (tinfo->pic_y / 2);
-	const unsigned char *py = ycbcr[0].data + yoff;
-	const unsigned char *pcb = ycbcr[1].data + cboff;
-	const unsigned char *pcr = ycbcr[2].data + cboff;
-	int posx, posy;
-
-	for(posy = 0; posy < h; posy++)
-	{
-		for(posx = 0; posx < w; posx++)
-		{
-			// http://www.theora.org/doc/Theora.pdf, 1.1 spec,
-			//  chapter 4.2 (Y'CbCr -> Y'PbPr -> R'G'B')
-			// These constants apparently work for NTSC _and_ PAL/SECAM.
-			const float yoffset = 16.0f;
-			const float yexcursion = 219.0f;
-			const float cboffset = 128.0f;
-			const float cbexcursion = 224.0f;
-			const float croffset = 128.0f;
-			const float crexcursion = 224.0f;
-			const float kr = 0.299f;
-			const float kb = 0.114f;
-
-			const float y = (((float)py[posx]) - yoffset) / yexcursion;
-			const float pb = (((float)pcb[posx / 2]) - cboffset) / cbexcursion;
-			const float pr = (((float)pcr[posx / 2]) - croffset) / crexcursion;
-			const float r = (y + (2.0f * (1.0f - kr) * pr)) * 255.0f;
-			const float g = (y - ((2.0f * (((1.0f - kb) * kb) / ((1.0f - kb) - kr))) * pb) - ((2.0f * (((1.0f - kr) * kr) / ((1.0f - kb) - kr))) * pr)) * 255.0f;
-			const float b = (y + (2.0f * (1.0f - kb) * pb)) * 255.0f;
-
-			*(dst++) = (unsigned char)((r < 0.0f) ? 0.0f : (r > 255.0f) ? 255.0f : r);
-			*(dst++) = (unsigned char)((g < 0.0f) ? 0.0f : (g > 255.0f) ? 255.0f : g);
-			*(dst++) = (unsigned char)((b < 0.0f) ? 0.0f : (b > 255.0f) ? 255.0f : b);
-			if(format == THEORAPLAYER_VIDFMT_BGR || format == THEORAPLAYER_VIDFMT_BGRA)
-				std::swap(*(dst - 1), *(dst - 3));
-			if(format == THEORAPLAYER_VIDFMT_RGBA || format == THEORAPLAYER_VIDFMT_BGRA)
-				*(dst++) = 0xFF;
-		} // for
-
-			// adjust to the start of the next line.
-		py += ystride;
-		pcb += cbstride * (posy % 2);
-		pcr += crstride * (posy % 2);
-	} // for
+	const int yoff = (tinfo->pic_x & ~1) + ystride * ((tinfo->pic_y & ~1) + row0);
+	const int cboff = (tinfo->pic_x / 2) + (cbstride) * (tinfo->pic_y / 2 + row0 / 2);
+	const int croff = (tinfo->pic_x / 2) + (crstride) * (tinfo->pic_y / 2 + row0 / 2);
+	THEORAPLAYER_Convert420(rowfn, ycbcr[0].data + yoff, ystride, ycbcr[1].data + cboff, cbstride, ycbcr[2].data + croff, crstride,
+		w, row1 - row0, pixels + w * bpp * row0, w * bpp);
 }
 
  // RGB
-static void ConvertVideoFrame420ToRGB(const th_info *tinfo, const th_ycbcr_buffer ycbcr, unsigned char* pixels)
+static void ConvertVideoFrame420ToRGB(const th_info *tinfo, const th_ycbcr_buffer ycbcr, unsigned char* pixels, int row0, int row1)
 {
-	THEORAPLAY_CVT_420_RGB(tinfo, ycbcr, pixels, THEORAPLAYER_VIDFMT_RGB);
+	//pick the fastest kernel the CPU supports, once
+	static const THEORAPLAYER_ConvertRowFn rowfn = THEORAPLAYER_GetConvertRowFn(THEORAPLAYER_VIDFMT_RGB, THEORAPLAYER_DetectConvertPath());
+	THEORAPLAY_CVT_420_RGB(tinfo, ycbcr, pixels, row0, row1, THEORAPLAYER_VIDFMT_RGB, rowfn);
 }
 
 // RGBA
-static void ConvertVideoFrame420ToRGBA(const th_info *tinfo, const th_ycbcr_buffer ycbcr, unsigned char* pixels)
+static void ConvertVideoFrame420ToRGBA(const th_info *tinfo, const th_ycbcr_buffer ycbcr, unsigned char* pixels, int row0, int row1)
 {
-	THEORAPLAY_CVT_420_RGB(tinfo, ycbcr, pixels, THEORAPLAYER_VIDFMT_RGBA);
+	static const THEORAPLAYER_ConvertRowFn rowfn = THEORAPLAYER_GetConvertRowFn(THEORAPLAYER_VIDFMT_RGBA, THEORAPLAYER_DetectConvertPath());
+	THEORAPLAY_CVT_420_RGB(tinfo, ycbcr, pixels, row0, row1, THEORAPLAYER_VIDFMT_RGBA, rowfn);
 }
 
  // BGR
-static void ConvertVideoFrame420ToBGR(const th_info *tinfo, const th_ycbcr_buffer ycbcr, unsigned char* pixels)
+static void ConvertVideoFrame420ToBGR(const th_info *tinfo, const th_ycbcr_buffer ycbcr, unsigned char* pixels, int row0, int row1)
 {
-	THEORAPLAY_CVT_420_RGB(tinfo, ycbcr, pixels, THEORAPLAYER_VIDFMT_BGR);
+	static const THEORAPLAYER_ConvertRowFn rowfn = THEORAPLAYER_GetConvertRowFn(THEORAPLAYER_VIDFMT_BGR, THEORAPLAYER_DetectConvertPath());
+	THEORAPLAY_CVT_420_RGB(tinfo, ycbcr, pixels, row0, row1, THEORAPLAYER_VIDFMT_BGR, rowfn);
 }
 
  // BGRA
-static void ConvertVideoFrame420ToBGRA(const th_info *tinfo, const th_ycbcr_buffer ycbcr, unsigned char* pixels)
+static void ConvertVideoFrame420ToBGRA(const th_info *tinfo, const th_ycbcr_buffer ycbcr, unsigned char* pixels, int row0, int row1)
+{
+	static const THEORAPLAYER_ConvertRowFn rowfn = THEORAPLAYER_GetConvertRowFn(THEORAPLAYER_VIDFMT_BGRA, THEORAPLAYER_DetectConvertPath());
+	THEORAPLAY_CVT_420_RGB(tinfo, ycbcr, pixels, row0, row1, THEORAPLAYER_VIDFMT_BGRA, rowfn);
+}
+
+
+static void* DefaultAlloc(THEORAPLAYER_Allocator*, size_t size, size_t alignment)
+{
+#if defined(_WIN32)
+	return _aligned_malloc(size, alignment);
+#else
+	void* ptr = NULL;
+	return (posix_memalign(&ptr, alignment, size) == 0) ? ptr : NULL;
+#endif
+}
+
+static void DefaultFree(THEORAPLAYER_Allocator*, void* ptr)
 {
-	THEORAPLAY_CVT_420_RGB(tinfo, ycbcr, pixels, THEORAPLAYER_VIDFMT_BGRA);
+#if defined(_WIN32)
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
 }
 
+//Single-producer/single-consumer ring of interleaved float samples.
+//The decode thread writes and the audio callback reads; neither side locks or allocates.
+struct THEORAPLAYER_AudioRing
+{
+	std::vector<float> samples;
+	unsigned int capacity = 0;  // in sample frames
+	int channels = 0;
+	int freq = 0;
+	unsigned long long base = 0;  // stream sample position of ring frame 0, moved by seeks
+
+	//Monotonic frame counters; the slot is the counter modulo the capacity.
+	std::atomic<unsigned long long> written{ 0 };
+	std::atomic<unsigned long long> read{ 0 };
+
+	void Init(int numChannels, int rate, unsigned int ms)
+	{
+		channels = numChannels;
+		freq = rate;
+		capacity = (unsigned int)(((unsigned long long)rate * ms + 999) / 1000);
+		if(capacity == 0)
+			capacity = 1;
+		samples.assign((size_t)capacity * channels, 0.0f);
+		Reset(0);
+	}
+
+	//Not safe against a concurrent reader
+	void Reset(unsigned long long position)
+	{
+		base = position;
+		written.store(0);
+		read.store(0);
+	}
+
+	unsigned int Available() const
+	{
+		return (unsigned int)(written.load(std::memory_order_acquire) - read.load(std::memory_order_relaxed));
+	}
+
+	//Producer: interleave as many planar frames as fit, returns the number written
+	int Write(float** pcm, int frames)
+	{
+		const unsigned long long w = written.load(std::memory_order_relaxed);
+		const unsigned int space = capacity - (unsigned int)(w - read.load(std::memory_order_acquire));
+		if((unsigned int)frames > space)
+			frames = (int)space;
+
+		unsigned int slot = (unsigned int)(w % capacity);
+		for(int i = 0; i < frames; ++i)
+		{
+			float* dst = &samples[(size_t)slot * channels];
+			for(int c = 0; c < channels; ++c)
+				dst[c] = pcm[c][i];
+			if(++slot == capacity)
+				slot = 0;
+		}
+		written.store(w + frames, std::memory_order_release);
+		return frames;
+	}
+
+	//Consumer: copy up to frames interleaved frames out, returns the number read
+	int Read(float* out, int frames, unsigned long long* position)
+	{
+		const unsigned long long r = read.load(std::memory_order_relaxed);
+		const unsigned int avail = (unsigned int)(written.load(std::memory_order_acquire) - r);
+		if((unsigned int)frames > avail)
+			frames = (int)avail;
+		if(position)
+			*position = r;
+
+		const unsigned int slot = (unsigned int)(r % capacity);
+		const unsigned int first = (frames < (int)(capacity - slot)) ? frames : capacity - slot;
+		memcpy(out, &samples[(size_t)slot * channels], (size_t)first * channels * sizeof(float));
+		if((unsigned int)frames > first)
+			memcpy(out + (size_t)first * channels, &samples[0], (size_t)(frames - first) * channels * sizeof(float));
+		read.store(r + frames, std::memory_order_release);
+		return frames;
+	}
+};
 
 struct THEORAPLAYER_Decoder
 {
@@ -171,21 +274,174 @@ struct THEORAPLAYER_Decoder
 
 	THEORAPLAYER_VideoFormat vidfmt;
 	ConvertVideoFrameFn vidcvt;
+	THEORAPLAYER_ConvertMode convertmode = THEORAPLAYER_CONVERT_FRAME;
+	bool trusted = false;  // THEORAPLAYER_OPEN_TRUSTED: no page CRCs
+
+	THEORAPLAYER_AudioPolicy audiopolicy = THEORAPLAYER_AUDIO_DISCARD;
+	unsigned int audiobufferms = THEORAPLAYER_DEFAULT_AUDIO_BUFFER_MS;
+	int audiochannels = 0;  // of the Vorbis stream, whether or not it is decoded
+	int audiofreq = 0;
+
+	// Streams picked with SelectVideoStream/SelectAudioStream, otherwise the first of each kind
+	bool selectvideo = false;
+	bool selectaudio = false;
+	int videoserial = 0;
+	int audioserial = 0;
+	THEORAPLAYER_AudioRing audio;
+
+	// Read size for FeedMoreOggData. It follows the running averages of page and video packet sizes,
+	// so high bitrate streams take fewer, larger reads.
+	std::atomic<long> readsize{ THEORAPLAYER_MIN_READ_SIZE };
+	long maxreadsize = THEORAPLAYER_DEFAULT_MAX_READ_SIZE;
+	long pagebytes = 0;
+	long packetbytes = 0;
+
+	// Io counters, written by whichever thread is decoding
+	std::atomic<unsigned long long> iobytes{ 0 };
+	std::atomic<unsigned long long> ioreads{ 0 };
+	std::atomic<unsigned long long> ionanoseconds{ 0 };
+	std::atomic<unsigned long long> iocompacted{ 0 };  // bytes libogg has moved within its buffers
+
+	// Post-processing asked for through the API, picked up by whichever thread is decoding.
+	// With ppadaptive, pplevel is the ceiling the controller works under.
+	std::atomic<int> pplevel{ 0 };
+	std::atomic<bool> ppadaptive{ false };
+	std::atomic<int> ppcurrent{ -1 };  // level on the decoder, for GetPostProcessingLevel
+
+	void ObservePage(long bytes)
+	{
+		pagebytes += (bytes - pagebytes) / 8;
+		UpdateReadSize();
+	}
+
+	void ObservePacket(long bytes)
+	{
+		packetbytes += (bytes - packetbytes) / 8;
+		UpdateReadSize();
+	}
+
+	// Enough to usually finish at least one page and one frame per read
+	void UpdateReadSize()
+	{
+		const long want = 2 * (pagebytes > packetbytes ? pagebytes : packetbytes);
+		long size = THEORAPLAYER_MIN_READ_SIZE;
+		while(size < want && size < maxreadsize)
+			size *= 2;
+		readsize.store(size < maxreadsize ? size : maxreadsize, std::memory_order_relaxed);
+	}
+
+	void CountRead(long bytes, std::chrono::steady_clock::time_point start)
+	{
+		const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		ioreads.fetch_add(1, std::memory_order_relaxed);
+		if(bytes > 0)
+			iobytes.fetch_add(bytes, std::memory_order_relaxed);
+		ionanoseconds.fetch_add(elapsed, std::memory_order_relaxed);
+	}
+
+	THEORAPLAYER_Allocator allocator = { DefaultAlloc, DefaultFree, NULL };
+	THEORAPLAYER_Allocator* userallocator = NULL;  // passed back to the user's callbacks
+
+	// keyframe index from LoadSeekIndex, in the user's memory or seekindexdata
+	const THEORAPLAYER_SeekIndexEntry* seekindex = NULL;
+	size_t seekindexcount = 0;
+	unsigned char* seekindexdata = NULL;
+
+	// Total size of the file behind the Io, or -1 if it can't tell. Leaves the read position where it was.
+	long long IoSize()
+	{
+		if(io->size)
+			return io->size(io);
+		if(!io->seek || !io->tell)
+			return -1;
+		const long long position = io->tell(io);
+		if(position < 0 || io->seek(io, 0, SEEK_END) != 0)
+			return -1;
+		const long long size = io->tell(io);
+		if(io->seek(io, position, SEEK_SET) != 0)
+			return -1;
+		return size;
+	}
+
+	// recycled frames, all with pixel storage of the current size
+	std::mutex poollock;
+	std::vector<VideoFrame*> pool;
+
+	void* Alloc(size_t size)
+	{
+		THEORAPLAYER_Allocator* a = userallocator ? userallocator : &allocator;
+		return a->alloc(a, size, THEORAPLAYER_FRAME_ALIGNMENT);
+	}
+
+	void Free(void* ptr)
+	{
+		if(!ptr)
+			return;
+		THEORAPLAYER_Allocator* a = userallocator ? userallocator : &allocator;
+		a->free(a, ptr);
+	}
 
 	~THEORAPLAYER_Decoder()
 	{
+		for(auto frame : pool)
+		{
+			Free(frame->pixels);
+			delete frame;
+		}
+		delete[] seekindexdata;
 		io->close(io);
 	}
 };
 
-static int FeedMoreOggData(THEORAPLAYER_Io *io, ogg_sync_state *sync)
+// Size of the pixel data for one frame in the given format
+static size_t FrameDataSize(unsigned int width, unsigned int height, THEORAPLAYER_VideoFormat format)
+{
+	const int bpp = THEORAPLAYER_BytesPerPixel(format);
+	if(bpp)
+		return (size_t)width * height * bpp;
+	// planar 4:2:0
+	return (size_t)width * height + 2 * (size_t)(width / 2) * (height / 2);
+}
+
+// Reads buflen bytes, or the decoder's adaptive read size if buflen is 0
+static int FeedMoreOggData(THEORAPLAYER_Decoder *ctx, ogg_sync_state *sync, long buflen = 0)
 {
-	long buflen = 4096;
+	THEORAPLAYER_Io *io = ctx->io;
+	if(buflen <= 0)
+		buflen = ctx->readsize.load(std::memory_order_relaxed);
+	const auto start = std::chrono::steady_clock::now();
+	if(io->view)
+	{
+		// Point the sync state straight at the Io's memory instead of copying into it. libogg only
+		// reads the buffer, and ogg_sync_buffer is never called on it, so it is never reallocated.
+		const long unread = sync->fill - sync->returned;
+		if(buflen > LONG_MAX - sync->fill)
+			buflen = LONG_MAX - sync->fill;
+		long len = 0;
+		const unsigned char *data = (const unsigned char *)io->view(io, buflen, &len);
+		ctx->CountRead(data ? len : 0, start);
+		if(data == NULL || len <= 0)
+			return 0;
+		if(unread == 0)
+		{
+			sync->data = (unsigned char *)data;
+			sync->returned = 0;
+			sync->fill = len;
+		}
+		else if(data == sync->data + sync->fill)
+			sync->fill += len;
+		else
+			return -1;  // a partial page can only continue into adjacent memory
+		sync->storage = sync->fill;
+		return 1;
+	}
+
 	char *buffer = ogg_sync_buffer(sync, buflen);
 	if(buffer == NULL)
 		return -1;
 
 	buflen = io->read(io, buffer, buflen);
+	ctx->CountRead(buflen, start);
 	if(buflen <= 0)
 		return 0;
 
@@ -207,6 +463,8 @@ struct THEORAPLAYER_State
 		th_comment_clear(&tcomment);
 		vorbis_comment_clear(&vcomment);
 		vorbis_info_clear(&vinfo);
+		if(ctx->io->view)
+			sync.data = NULL;  // borrowed from the Io
 		ogg_sync_clear(&sync);
 	}
 
@@ -230,16 +488,82 @@ struct THEORAPLAYER_State
 	vorbis_block vblock;
 	th_dec_ctx *tdec = NULL;
 	th_setup_info *tsetup = NULL;
+	int stripes = 0;  // stripe callback registered with tdec
+	int pplevel = 0;  // post-processing level set on tdec
+	int pplevelmax = 0;  // highest level tdec supports
+	int pprequest = -1;  // ctx->pplevel as last applied
+	bool ppadaptive = false;
+	bool ppraised = false;  // the last adaptive change was a raise
+	double ppms = 0.0;  // running average of the time to decode a frame at the current level
+	int ppframes = 0;  // frames decoded at the current level
+	int pphold = THEORAPLAYER_PP_HOLD_FRAMES;
+	ogg_int64_t nextframe = 0;  // index of the frame the next video packet decodes to
+	unsigned char* stripe_pixels = NULL;  // output for the frame currently in th_decode_packetin
+
+	// Theora packets pulled out of tstream by a seek but not decoded yet. They point into the
+	// stream's body buffer, so they have to be used up before the next page goes into tstream.
+	std::vector<ogg_packet> pending;
+	size_t pendingnext = 0;
+	long long syncpos = 0;  // file offset of the next byte ogg_sync has not consumed, while seeking
+	ogg_int64_t audioskipto = -1;  // after a seek, drop decoded audio before this sample
+
+	// Called from inside th_decode_packetin as each band of rows finishes decoding.
+	// Rows arrive bottom to top, in frame coordinates.
+	static void StripeDecoded(void *ctx, th_ycbcr_buffer ycbcr, int yfrag0, int yfrag_end)
+	{
+		THEORAPLAYER_State* state = (THEORAPLAYER_State*)ctx;
+		const int h = state->tinfo.pic_height;
+		const int top = state->tinfo.pic_y & ~1;
+		int row0 = yfrag0 * 8 - top;
+		int row1 = yfrag_end * 8 - top;
+		if(row0 < 0)
+			row0 = 0;
+		if(row1 > h)
+			row1 = h;
+		if(row0 < row1)
+			state->ctx->vidcvt(&state->tinfo, ycbcr, state->stripe_pixels, row0, row1);
+	}
+
+	void UpdateStripeCallback()
+	{
+		SetStripeCallback(ctx->convertmode == THEORAPLAYER_CONVERT_STRIPES);
+	}
+
+	void SetStripeCallback(int want)
+	{
+		if(want == stripes)
+			return;
+
+		th_stripe_callback cb;
+		cb.ctx = this;
+		cb.stripe_decoded = want ? StripeDecoded : NULL;
+		th_decode_ctl(tdec, TH_DECCTL_SET_STRIPE_CB, &cb, sizeof(cb));
+		stripes = want;
+	}
 
 	void QueueOggPage()
 	{
-		if(tpackets) ogg_stream_pagein(&tstream, &page);
-		if(vpackets) ogg_stream_pagein(&vstream, &page);
+		// Pages of streams that aren't decoded go no further than their serial number.
+		// Past the headers, audio pages only go in if DecodeAudio is going to take the packets back out.
+		// Vorbis starts the audio on a fresh page, so none of them carries a piece of a header.
+		const int serialno = ogg_page_serialno(&page);
+		if(tpackets && serialno == tstream.serialno)
+			ogg_stream_pagein(&tstream, &page);
+		else if(vpackets && serialno == vstream.serialno && (vpackets < 3 || AudioEnabled()))
+			ogg_stream_pagein(&vstream, &page);
+
+		ogg_int64_t compacted = sync.compacted;
+		if(tpackets)
+			compacted += tstream.compacted;
+		if(vpackets)
+			compacted += vstream.compacted;
+		ctx->iocompacted.store((unsigned long long)compacted, std::memory_order_relaxed);
 	}
 
 	int Prepare()
 	{
 		ogg_sync_init(&sync);
+		ogg_sync_trusted(&sync, ctx->trusted);
 		vorbis_info_init(&vinfo);
 		vorbis_comment_init(&vcomment);
 		th_info_init(&tinfo);
@@ -248,7 +572,7 @@ struct THEORAPLAYER_State
 		int readingHeader = 1;
 		while(readingHeader)
 		{
-			if(FeedMoreOggData(ctx->io, &sync) <= 0)
+			if(FeedMoreOggData(ctx, &sync) <= 0)
 				return -1;
 
 			// parse out the initial header.
@@ -263,16 +587,23 @@ struct THEORAPLAYER_State
 					break;
 				} // if
 
-				ogg_stream_init(&test, ogg_page_serialno(&page));
+				// streams that weren't picked never get a stream state
+				const int serialno = ogg_page_serialno(&page);
+				const int wantvideo = !tpackets && (!ctx->selectvideo || serialno == ctx->videoserial);
+				const int wantaudio = !vpackets && ctx->audiopolicy != THEORAPLAYER_AUDIO_IGNORE && (!ctx->selectaudio || serialno == ctx->audioserial);
+				if(!wantvideo && !wantaudio)
+					continue;
+
+				ogg_stream_init(&test, serialno);
 				ogg_stream_pagein(&test, &page);
 				ogg_stream_packetout(&test, &packet);
 
-				if(!tpackets && (th_decode_headerin(&tinfo, &tcomment, &tsetup, &packet) >= 0))
+				if(wantvideo && (th_decode_headerin(&tinfo, &tcomment, &tsetup, &packet) >= 0))
 				{
 					memcpy(&tstream, &test, sizeof(test));
 					tpackets = 1;
 				} // if
-				else if(!vpackets && (vorbis_synthesis_headerin(&vinfo, &vcomment, &packet) >= 0))
+				else if(wantaudio && (vorbis_synthesis_headerin(&vinfo, &vcomment, &packet) >= 0))
 				{
 					memcpy(&vstream, &test, sizeof(test));
 					vpackets = 1;
@@ -285,9 +616,10 @@ struct THEORAPLAYER_State
 			} // while
 		}
 
-		//Missing audio or video streams?
-		//FIXME: No audio should be fine to continue, though?
-		if(!vpackets || !tpackets)
+		//Need video; audio is optional unless a particular stream was asked for
+		if(!tpackets)
+			return -1;
+		if(!vpackets && ctx->selectaudio && ctx->audiopolicy != THEORAPLAYER_AUDIO_IGNORE)
 			return -1;
 
 		// apparently there are two more theora and two more vorbis headers next.
@@ -314,7 +646,7 @@ struct THEORAPLAYER_State
 			  // get another page, try again?
 			if(ogg_sync_pageout(&sync, &page) > 0)
 				QueueOggPage();
-			else if(FeedMoreOggData(ctx->io, &sync) <= 0)
+			else if(FeedMoreOggData(ctx, &sync) <= 0)
 				return -1;
 		} // while
 
@@ -347,12 +679,9 @@ struct THEORAPLAYER_State
 			if(!tdec)
 				return -1;
 
-			// Set decoder to maximum post-processing level.
-			//  Theoretically we could try dropping this level if we're not keeping up.
-			int pp_level_max = 0;
-			// !!! FIXME: maybe an API to set this?
-			//th_decode_ctl(tdec, TH_DECCTL_GET_PPLEVEL_MAX, &pp_level_max, sizeof(pp_level_max));
-			th_decode_ctl(tdec, TH_DECCTL_SET_PPLEVEL, &pp_level_max, sizeof(pp_level_max));
+			// Post-processing is off unless asked for with SetPostProcessingLevel or EnableAdaptivePostProcessing
+			th_decode_ctl(tdec, TH_DECCTL_GET_PPLEVEL_MAX, &pplevelmax, sizeof(pplevelmax));
+			UpdatePostProcessing();
 		} // if
 
 		//Don't need the tsetup object anymore
@@ -363,6 +692,11 @@ struct THEORAPLAYER_State
 		}
 
 		if(vpackets)
+		{
+			ctx->audiochannels = vinfo.channels;
+			ctx->audiofreq = (int)vinfo.rate;
+		}
+		if(vpackets && ctx->audiopolicy == THEORAPLAYER_AUDIO_DECODE)
 		{
 			vdsp_init = (vorbis_synthesis_init(&vdsp, &vinfo) == 0);
 			if(!vdsp_init)
@@ -370,13 +704,402 @@ struct THEORAPLAYER_State
 			vblock_init = (vorbis_block_init(&vdsp, &vblock) == 0);
 			if(!vblock_init)
 				return -1;
+			if(ctx->audio.capacity == 0)
+				ctx->audio.Init(vinfo.channels, (int)vinfo.rate, ctx->audiobufferms);
 		}
 
 		return 1;
 	} //Prepare
 
-	int DecodeNextVideoFrame(VideoFrame* frame)
+	//Fill in the frame metadata and make sure it has room for the pixels
+	int AllocateFrame(VideoFrame* frame)
+	{
+		frame->fps = fps;
+		frame->width = tinfo.pic_width;
+		frame->height = tinfo.pic_height;
+		frame->format = ctx->vidfmt;
+		if(!frame->pixels)
+			frame->pixels = (unsigned char*)ctx->Alloc(FrameDataSize(frame->width, frame->height, frame->format));
+		if(frame->pixels == NULL)
+		{
+			return -1;
+		} // if
+		return 1;
+	}
+
+	// 1 for streams from Theora 3.2.1 on, where granulepos counts frames from 1
+	int GranuleBias() const
+	{
+		if(tinfo.version_major != 3)
+			return tinfo.version_major > 3;
+		if(tinfo.version_minor != 2)
+			return tinfo.version_minor > 2;
+		return tinfo.version_subminor >= 1;
+	}
+
+	// Index of the keyframe a granulepos refers to
+	ogg_int64_t GranuleKeyframe(ogg_int64_t granule) const
+	{
+		return (granule >> tinfo.keyframe_granule_shift) - GranuleBias();
+	}
+
+	// Same timestamp that DecodeNextVideoFrame reports for a frame index
+	unsigned int FrameMs(ogg_int64_t frame) const
+	{
+		return (unsigned int)((frame + 1) * ((double)tinfo.fps_denominator / tinfo.fps_numerator) * 1000.0);
+	}
+
+	int SeekIo(long long offset)
+	{
+		if(ctx->io->seek(ctx->io, offset, SEEK_SET) != 0)
+			return -1;
+		ogg_sync_reset(&sync);
+		syncpos = offset;
+		return 1;
+	}
+
+	// Read the next page after a SeekIo, and its file offset. 0 at the end of the file.
+	// Bisection probes only need a page or so, so they read with a small buflen.
+	int NextPage(long long* offset, long buflen = 0)
+	{
+		for(;;)
+		{
+			const long result = ogg_sync_pageseek(&sync, &page);
+			if(result > 0)
+			{
+				*offset = syncpos;
+				syncpos += result;
+				return 1;
+			}
+			if(result < 0)
+			{
+				syncpos -= result;  // skipped garbage
+				continue;
+			}
+			const int rc = FeedMoreOggData(ctx, &sync, buflen);
+			if(rc <= 0)
+				return rc;
+		}
+	}
+
+	// Find the first Theora page that starts in [start, end) and finishes a packet
+	int FindTheoraPage(long long start, long long end, long long* offset, ogg_int64_t* granule)
+	{
+		if(SeekIo(start) < 0)
+			return -1;
+		for(;;)
+		{
+			const int rc = NextPage(offset, THEORAPLAYER_MIN_READ_SIZE);
+			if(rc <= 0)
+				return rc;
+			if(*offset >= end)
+				return 0;
+			if(ogg_page_serialno(&page) == tstream.serialno && ogg_page_granulepos(&page) >= 0)
+			{
+				*granule = ogg_page_granulepos(&page);
+				return 1;
+			}
+		}
+	}
+
+	// Bisect for the last Theora page whose packets all come before frame target.
+	// Returns its offset (0 if there is none) and granulepos (-1 if none), and the granulepos of
+	// the closest page seen at or after target (-1 if none).
+	long long Bisect(long long size, ogg_int64_t target, ogg_int64_t* logranule, ogg_int64_t* higranule)
+	{
+		// below this, reading forward beats another round of seeking
+		const long long linear = 64 * 1024;
+
+		long long lo = 0;
+		long long hi = size;
+		*logranule = -1;
+		*higranule = -1;
+		while(hi - lo > linear)
+		{
+			const long long mid = lo + (hi - lo) / 2;
+			long long offset;
+			ogg_int64_t granule;
+			const int rc = FindTheoraPage(mid, hi, &offset, &granule);
+			if(rc < 0)
+				return -1;
+			if(rc > 0 && th_granule_frame(tdec, granule) < target)
+			{
+				lo = offset;
+				*logranule = granule;
+			}
+			else
+			{
+				hi = mid;
+				if(rc > 0)
+					*higranule = granule;
+			}
+		}
+		return lo;
+	}
+
+	void SetPostProcessing(int level)
+	{
+		th_decode_ctl(tdec, TH_DECCTL_SET_PPLEVEL, &level, sizeof(level));
+		pplevel = level;
+		ppframes = 0;
+		ctx->ppcurrent = level;
+	}
+
+	// Pick up a level or mode set through the API since the last frame
+	void UpdatePostProcessing()
+	{
+		const int level = ctx->pplevel;
+		const int request = level < pplevelmax ? level : pplevelmax;
+		const bool adaptive = ctx->ppadaptive;
+		if(request == pprequest && adaptive == ppadaptive)
+			return;
+		pprequest = request;
+		ppadaptive = adaptive;
+		ppraised = false;
+		pphold = THEORAPLAYER_PP_HOLD_FRAMES;
+		SetPostProcessing((adaptive && pplevel < request) ? pplevel : request);
+	}
+
+	// Adaptive post-processing, fed the time each converted frame took. The level steps down while decoding
+	// takes over half the frame budget, leaving the rest for the caller, and back up while it takes under a quarter.
+	// A raise that has to be undone before the hold is up doubles the hold, so a level that doesn't fit
+	// isn't retried every second.
+	void AdaptPostProcessing(double ms)
+	{
+		if(!ppadaptive || fps <= 0.0)
+			return;
+		ppms = ppframes ? ppms + (ms - ppms) / 8 : ms;
+		if(++ppframes < 8)
+			return;
+
+		const double budget = 1000.0 / fps;
+		if(ppms > budget / 2 && pplevel > 0)
+		{
+			if(ppraised && ppframes < pphold)
+				pphold = (pphold * 2 < THEORAPLAYER_PP_MAX_HOLD_FRAMES) ? pphold * 2 : THEORAPLAYER_PP_MAX_HOLD_FRAMES;
+			else
+				pphold = THEORAPLAYER_PP_HOLD_FRAMES;
+			ppraised = false;
+			SetPostProcessing(pplevel - 1);
+		}
+		else if(ppms < budget / 4 && pplevel < pprequest && ppframes >= pphold)
+		{
+			ppraised = true;
+			SetPostProcessing(pplevel + 1);
+		}
+	}
+
+	// Point planar at the picture inside the decoder's buffers, with the same cropping as the converters
+	void PlaneViews(const th_ycbcr_buffer ycbcr, THEORAPLAYER_PlanarFrame* planar)
+	{
+		planar->fps = fps;
+		planar->width = tinfo.pic_width;
+		planar->height = tinfo.pic_height;
+		for(int p = 0; p < 3; p++)
+		{
+			const int x = p ? tinfo.pic_x / 2 : (tinfo.pic_x & ~1);
+			const int y = p ? tinfo.pic_y / 2 : (tinfo.pic_y & ~1);
+			planar->planes[p] = ycbcr[p].data + x + (ptrdiff_t)ycbcr[p].stride * y;
+			planar->strides[p] = ycbcr[p].stride;
+		}
+	}
+
+	// Decode a packet for its side effects on the reference frames only: no stripe conversion, and no
+	// post-processing, which only touches the output copy. Returns th_decode_packetin's result.
+	int DecodePacketOnly(ogg_packet* op, ogg_int64_t* granulepos)
+	{
+		SetStripeCallback(0);
+		// level 1 still tracks the DC quantizers, which deblocking later frames depends on
+		const int skippp = pplevel > 1;
+		if(skippp)
+		{
+			int level = 1;
+			th_decode_ctl(tdec, TH_DECCTL_SET_PPLEVEL, &level, sizeof(level));
+		}
+		const int result = th_decode_packetin(tdec, op, granulepos);
+		if(skippp)
+			th_decode_ctl(tdec, TH_DECCTL_SET_PPLEVEL, &pplevel, sizeof(pplevel));
+		return result;
+	}
+
+	// Reposition so the next decoded frame is the first one with a timestamp at or after ms.
+	// Returns 0 if that is past the end of the video.
+	int Seek(unsigned int ms)
+	{
+		if(!tpackets || !ctx->io->seek || !ctx->io->tell)
+			return -1;
+
+		// first frame whose timestamp, as GetVideoFrame computes it, is at or after ms
+		ogg_int64_t target = 0;
+		if(tinfo.fps_numerator && tinfo.fps_denominator)
+		{
+			target = (ogg_int64_t)ms * tinfo.fps_numerator / ((ogg_int64_t)1000 * tinfo.fps_denominator);
+			while(target > 0 && FrameMs(target - 1) >= ms)
+				target--;
+			while(FrameMs(target) < ms)
+				target++;
+		}
+
+		long long start = 0;
+		if(ctx->seekindexcount)
+		{
+			// the index already knows where the keyframe packet starts
+			start = THEORAPLAYER_FindSeekIndexEntry(ctx->seekindex, ctx->seekindexcount, target)->offset;
+		}
+		else
+		{
+			const long long size = ctx->IoSize();
+			if(size < 0)
+				return -1;
+
+			ogg_int64_t logranule, higranule;
+			start = Bisect(size, target, &logranule, &higranule);
+			if(start < 0)
+				return -1;
+
+			// the frame we want depends on its keyframe, which may be further back
+			if(logranule >= 0)
+			{
+				ogg_int64_t keyframe = GranuleKeyframe(logranule);
+				if(higranule >= 0 && GranuleKeyframe(higranule) <= target)
+					keyframe = GranuleKeyframe(higranule);
+				if(keyframe <= th_granule_frame(tdec, logranule))
+				{
+					start = Bisect(size, keyframe, &logranule, &higranule);
+					if(start < 0)
+						return -1;
+				}
+			}
+		}
+
+		if(SeekIo(start) < 0)
+			return -1;
+		ogg_stream_reset(&tstream);
+		if(vpackets)
+			ogg_stream_reset(&vstream);
+		if(vdsp_init)
+			vorbis_synthesis_restart(&vdsp);
+		if(AudioEnabled())
+		{
+			audioskipto = (ogg_int64_t)ms * vinfo.rate / 1000;
+			ctx->audio.Reset(audioskipto);
+		}
+		pending.clear();
+		pendingnext = 0;
+		eos = 0;
+
+		// Walk forward from there: drop packets until a keyframe, then decode without output up to the target
+		int keyframe = 0;
+		for(;;)
+		{
+			long long offset;
+			const int rc = NextPage(&offset);
+			if(rc < 0)
+				return -1;
+			if(rc == 0)
+			{
+				eos = 1;
+				return 0;
+			}
+
+			QueueOggPage();
+			if(ogg_page_serialno(&page) != tstream.serialno)
+				continue;
+
+			// only the last packet finished on a page carries the granulepos, so count back from it
+			ogg_packet op;
+			while(ogg_stream_packetout(&tstream, &op) > 0)
+				pending.push_back(op);
+			const ogg_int64_t granule = ogg_page_granulepos(&page);
+			ogg_int64_t frame = (granule >= 0) ? th_granule_frame(tdec, granule) - (ogg_int64_t)pending.size() + 1 : 0;
+			for(pendingnext = 0; pendingnext < pending.size(); ++pendingnext, ++frame)
+			{
+				ogg_packet* current = &pending[pendingnext];
+				if(!keyframe)
+				{
+					if(th_packet_iskeyframe(current) != 1)
+						continue;
+					keyframe = 1;
+					ogg_int64_t granpos = (frame + GranuleBias()) << tinfo.keyframe_granule_shift;
+					th_decode_ctl(tdec, TH_DECCTL_SET_GRANPOS, &granpos, sizeof(granpos));
+				}
+				if(frame >= target)
+				{
+					nextframe = frame;
+					DecodeAudio();
+					return 1;
+				}
+				const int decoded = DecodePacketOnly(current, NULL);
+				if(decoded != 0 && decoded != TH_DUPFRAME)
+					return -1;
+			}
+			pending.clear();
+			pendingnext = 0;
+			DecodeAudio();
+		}
+	}
+
+	int AudioEnabled() const
+	{
+		return vblock_init && ctx->audio.capacity;
+	}
+
+	//True if there is decoded or still-packetized audio that has not made it into the ring yet
+	int AudioPending()
+	{
+		if(!AudioEnabled())
+			return 0;
+		return vorbis_synthesis_pcmout(&vdsp, NULL) > 0 || ogg_stream_packetpeek(&vstream, NULL) == 1;
+	}
+
+	//Synthesize whatever Vorbis packets the video demux has queued so far, until the ring is full
+	void DecodeAudio()
+	{
+		if(!AudioEnabled())
+			return;
+
+		for(;;)
+		{
+			float** pcm;
+			const int frames = vorbis_synthesis_pcmout(&vdsp, &pcm);
+			if(frames > 0 && audioskipto >= 0)
+			{
+				// the sample position is unknown until a packet carrying a granulepos has gone in
+				int drop = frames;
+				if(vdsp.granulepos >= 0)
+				{
+					const ogg_int64_t first = vdsp.granulepos - frames;
+					if(first + frames > audioskipto)
+					{
+						drop = (first < audioskipto) ? (int)(audioskipto - first) : 0;
+						audioskipto = -1;
+					}
+				}
+				vorbis_synthesis_read(&vdsp, drop);
+				continue;
+			}
+			if(frames > 0)
+			{
+				const int written = ctx->audio.Write(pcm, frames);
+				vorbis_synthesis_read(&vdsp, written);
+				if(written < frames)
+					return;  // ring is full, leave the rest for later
+				continue;
+			}
+
+			ogg_packet apacket;
+			if(ogg_stream_packetout(&vstream, &apacket) <= 0)
+				return;  // the video side will queue more pages
+			if(vorbis_synthesis(&vblock, &apacket) == 0)
+				vorbis_synthesis_blockin(&vdsp, &vblock);
+		}
+	}
+
+	//Decode the next frame into frame, or point planar at the decoder's own picture. With neither, decode
+	//only for the effect on the reference frames: no conversion, and no post-processing, which only touches the output copy.
+	int DecodeNextVideoFrame(VideoFrame* frame, THEORAPLAYER_PlanarFrame* planar = NULL)
 	{
+		DecodeAudio();
 		if(eos)
 		{
 			return 0;
@@ -388,9 +1111,18 @@ struct THEORAPLAYER_State
 		{
 			// Theora, according to example_player.c, is
 			//  "one [packet] in, one [frame] out."
-			while(ogg_stream_packetout(&tstream, &packet) <= 0)
+			if(pendingnext < pending.size())
+				packet = pending[pendingnext++];
+			else while(ogg_stream_packetout(&tstream, &packet) <= 0)
 			{
-				const int rc = FeedMoreOggData(ctx->io, &sync);
+				// pages can be left in the sync buffer by a seek, use those up before reading
+				if(ogg_sync_pageout(&sync, &page) > 0)
+				{
+					ctx->ObservePage(page.header_len + page.body_len);
+					QueueOggPage();
+					continue;
+				}
+				const int rc = FeedMoreOggData(ctx, &sync);
 				if(rc == 0)
 				{
 					eos = 1;  // end of stream
@@ -398,11 +1130,6 @@ struct THEORAPLAYER_State
 				}
 				else if(rc < 0)
 					return -1;  // i/o error, etc.
-				else
-				{
-					while(ogg_sync_pageout(&sync, &page) > 0)
-						QueueOggPage();
-				} // else
 			}
 
 			ogg_int64_t granulepos = 0;
@@ -411,58 +1138,585 @@ struct THEORAPLAYER_State
 			if(packet.granulepos >= 0)
 				th_decode_ctl(tdec, TH_DECCTL_SET_GRANPOS, &packet.granulepos, sizeof(packet.granulepos));
 
-			if(th_decode_packetin(tdec, &packet, &granulepos) == 0)  // new frame!
+			ctx->ObservePacket(packet.bytes);
+			if(frame && AllocateFrame(frame) < 0)
+				return -1;
+
+			int decoded;
+			const auto start = std::chrono::steady_clock::now();
+			if(frame || planar)
+			{
+				// in stripe mode, the pixels get converted while th_decode_packetin is still running
+				UpdatePostProcessing();
+				if(frame)
+					UpdateStripeCallback();
+				else
+					SetStripeCallback(0);
+				stripe_pixels = frame ? frame->pixels : NULL;
+				decoded = th_decode_packetin(tdec, &packet, &granulepos);
+				stripe_pixels = NULL;
+			}
+			else
+				decoded = DecodePacketOnly(&packet, &granulepos);
+			if(decoded == 0 || decoded == TH_DUPFRAME)
+				nextframe = th_granule_frame(tdec, granulepos) + 1;
+			if(decoded == 0)  // new frame!
 			{
-				th_ycbcr_buffer ycbcr;
-				if(th_decode_ycbcr_out(tdec, ycbcr) == 0)
+				if(planar || (frame && !stripes))
 				{
-					const double videotime = th_granule_time(tdec, granulepos);
-					frame->playms = (unsigned int)(videotime * 1000.0);
-					frame->fps = fps;
-					frame->width = tinfo.pic_width;
-					frame->height = tinfo.pic_height;
-					frame->format = ctx->vidfmt;
-					if(!frame->pixels)
-					{
-						//FIXME: use a user-supplied allocator
-						size_t allocSize = frame->width * frame->height * 4;
-						if(frame->format == THEORAPLAYER_VIDFMT_RGB || frame->format == THEORAPLAYER_VIDFMT_BGR)
-							allocSize = frame->width * frame->height * 3;
-						frame->pixels = new unsigned char[allocSize];
-					}
+					th_ycbcr_buffer ycbcr;
+					if(th_decode_ycbcr_out(tdec, ycbcr) != 0)
+						return 0;
 
 					//copy the pixels over in the requested format
-					ctx->vidcvt(&tinfo, ycbcr, frame->pixels);
-					if(frame->pixels == NULL)
-					{
-						return -1;
-					} // if
+					if(frame)
+						ctx->vidcvt(&tinfo, ycbcr, frame->pixels, 0, tinfo.pic_height);
+					else
+						PlaneViews(ycbcr, planar);
+				}
 
-					saw_video_frame = 1;
-				} // if
+				if(frame || planar)
+				{
+					const double videotime = th_granule_time(tdec, granulepos);
+					(frame ? frame->playms : planar->playms) = (unsigned int)(videotime * 1000.0);
+					AdaptPostProcessing(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+				}
+				saw_video_frame = 1;
 			} // if
 		} // if
 
+		DecodeAudio();
 		return saw_video_frame;
 	}
 };
 
-static size_t IoFopenRead(THEORAPLAYER_Io *io, void *buf, long buflen)
+//Worker thread and frame ring for async decoding.
+//Single producer (the worker) and single consumer (the render thread). The consumer never blocks;
+//the worker sleeps on the condition variable while the ring is full.
+//With a clock, the worker drops frames that would be stale before they could be shown, decoding them
+//only for the reference frames, so a stream that has fallen behind catches up without converting them.
+struct THEORAPLAYER_Async
 {
-	FILE *f = (FILE *)io->userdata;
-	const size_t br = fread(buf, 1, buflen, f);
-	if((br == 0) && ferror(f))
-		return -1;
-	return br;
-} // IoFopenRead
+	THEORAPLAYER_State* state = nullptr;
+	THEORAPLAYER_Clock* clock = nullptr;
+	std::vector<VideoFrame> frames;
+	std::thread worker;
+	std::mutex lock;
+	std::condition_variable wake;
+
+	//Monotonic counters; slot index is the counter modulo the ring size.
+	//written <= frames produced, acquired <= handed to the consumer, released <= handed back.
+	std::atomic<unsigned int> written{ 0 };
+	std::atomic<unsigned int> released{ 0 };
+	unsigned int acquired = 0;  //consumer thread only
+
+	std::atomic<bool> quit{ false };
+	std::atomic<bool> finished{ false };
+	std::atomic<bool> error{ false };
+	std::atomic<unsigned int> underruns{ 0 };
+	std::atomic<unsigned int> ontime{ 0 };
+	std::atomic<unsigned int> late{ 0 };
+	std::atomic<unsigned int> dropped{ 0 };
+
+	void Run()
+	{
+		const unsigned int capacity = (unsigned int)frames.size();
+		while(!quit.load())
+		{
+			const unsigned int slot = written.load(std::memory_order_relaxed);
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				wake.wait(guard, [&] { return quit.load() || slot - released.load(std::memory_order_acquire) < capacity; });
+			}
+			if(quit.load())
+				break;
 
+			// frame n is on screen from FrameMs(n) until frame n + 1 replaces it at FrameMs(n + 1)
+			VideoFrame* frame = &frames[slot % capacity];
+			int drop = 0;
+			if(clock && state->fps > 0.0)
+				drop = clock->now(clock) >= state->FrameMs(state->nextframe + 1);
 
-static void IoFopenClose(THEORAPLAYER_Io *io)
-{
-	FILE *f = (FILE *)io->userdata;
-	fclose(f);
-	free(io);
-} // IoFopenClose
+			const int result = state->DecodeNextVideoFrame(drop ? NULL : frame);
+			if(result < 0)
+			{
+				error.store(true);
+				break;
+			}
+			if(result > 0 && drop)
+				dropped.fetch_add(1, std::memory_order_relaxed);
+			else if(result > 0)
+			{
+				if(clock && clock->now(clock) > frame->playms)
+					late.fetch_add(1, std::memory_order_relaxed);
+				else if(clock)
+					ontime.fetch_add(1, std::memory_order_relaxed);
+				written.store(slot + 1, std::memory_order_release);
+			}
+			else if(state->eos)
+			{
+				//keep feeding the audio ring until the tail of the stream is out
+				if(!state->AudioPending())
+					break;
+				std::this_thread::sleep_for(std::chrono::milliseconds(2));
+			}
+		}
+		finished.store(true, std::memory_order_release);
+	}
+
+	~THEORAPLAYER_Async()
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			quit.store(true);
+		}
+		wake.notify_one();
+		if(worker.joinable())
+			worker.join();
+		for(auto& frame : frames)
+			state->ctx->Free(frame.pixels);
+	}
+};
+
+static size_t IoFopenRead(THEORAPLAYER_Io *io, void *buf, long buflen)
+{
+	FILE *f = (FILE *)io->userdata;
+	const size_t br = fread(buf, 1, buflen, f);
+	if((br == 0) && ferror(f))
+		return -1;
+	return br;
+} // IoFopenRead
+
+
+static int IoFopenSeek(THEORAPLAYER_Io *io, long long offset, int whence)
+{
+	FILE *f = (FILE *)io->userdata;
+#if defined(_WIN32)
+	return _fseeki64(f, offset, whence);
+#else
+	return fseeko(f, (off_t)offset, whence);
+#endif
+} // IoFopenSeek
+
+static long long IoFopenTell(THEORAPLAYER_Io *io)
+{
+	FILE *f = (FILE *)io->userdata;
+#if defined(_WIN32)
+	return _ftelli64(f);
+#else
+	return (long long)ftello(f);
+#endif
+} // IoFopenTell
+
+
+static void IoFopenClose(THEORAPLAYER_Io *io)
+{
+	FILE *f = (FILE *)io->userdata;
+	fclose(f);
+	//the io struct itself belongs to the TheoraPlayer, which deletes it
+} // IoFopenClose
+
+//Backing for the memory and mapped file Io
+struct IoMemory
+{
+	const unsigned char *data = NULL;
+	long long size = 0;
+	long long position = 0;
+	int mapped = 0;
+#if defined(_WIN32)
+	HANDLE mapping = NULL;
+#endif
+};
+
+static size_t IoMemoryRead(THEORAPLAYER_Io *io, void *buf, long buflen)
+{
+	IoMemory *mem = (IoMemory *)io->userdata;
+	long long len = mem->size - mem->position;
+	if(len > buflen)
+		len = buflen;
+	memcpy(buf, mem->data + mem->position, (size_t)len);
+	mem->position += len;
+	return (size_t)len;
+} // IoMemoryRead
+
+static const void *IoMemoryView(THEORAPLAYER_Io *io, long maxlen, long *len)
+{
+	IoMemory *mem = (IoMemory *)io->userdata;
+	long long avail = mem->size - mem->position;
+	if(avail > maxlen)
+		avail = maxlen;
+	const void *data = mem->data + mem->position;
+	mem->position += avail;
+	*len = (long)avail;
+	return data;
+} // IoMemoryView
+
+static int IoMemorySeek(THEORAPLAYER_Io *io, long long offset, int whence)
+{
+	IoMemory *mem = (IoMemory *)io->userdata;
+	if(whence == SEEK_CUR)
+		offset += mem->position;
+	else if(whence == SEEK_END)
+		offset += mem->size;
+	if(offset < 0 || offset > mem->size)
+		return -1;
+	mem->position = offset;
+	return 0;
+} // IoMemorySeek
+
+static long long IoMemoryTell(THEORAPLAYER_Io *io)
+{
+	return ((IoMemory *)io->userdata)->position;
+} // IoMemoryTell
+
+static long long IoMemorySize(THEORAPLAYER_Io *io)
+{
+	return ((IoMemory *)io->userdata)->size;
+} // IoMemorySize
+
+static void IoMemoryClose(THEORAPLAYER_Io *io)
+{
+	IoMemory *mem = (IoMemory *)io->userdata;
+	if(mem->mapped)
+	{
+#if defined(_WIN32)
+		UnmapViewOfFile(mem->data);
+		CloseHandle(mem->mapping);
+#else
+		munmap((void *)mem->data, (size_t)mem->size);
+#endif
+	}
+	delete mem;
+	delete io;
+} // IoMemoryClose
+
+void THEORAPLAYER_InitIo(THEORAPLAYER_Io *io)
+{
+	if(io)
+		*io = THEORAPLAYER_Io();
+} // THEORAPLAYER_InitIo
+
+static THEORAPLAYER_Io *NewIoMemory(IoMemory *mem)
+{
+	THEORAPLAYER_Io *io = new THEORAPLAYER_Io();
+	io->read = IoMemoryRead;
+	io->close = IoMemoryClose;
+	io->userdata = mem;
+	io->seek = IoMemorySeek;
+	io->tell = IoMemoryTell;
+	io->size = IoMemorySize;
+	io->view = IoMemoryView;
+	return io;
+} // NewIoMemory
+
+THEORAPLAYER_Io *THEORAPLAYER_CreateMemoryIo(const void *data, size_t size)
+{
+	if(!data && size)
+		return NULL;
+
+	IoMemory *mem = new IoMemory;
+	mem->data = (const unsigned char *)data;
+	mem->size = (long long)size;
+	return NewIoMemory(mem);
+} // THEORAPLAYER_CreateMemoryIo
+
+THEORAPLAYER_Io *THEORAPLAYER_CreateMappedIo(const char *filename)
+{
+	IoMemory *mem = new IoMemory;
+	mem->mapped = 1;
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if(file == INVALID_HANDLE_VALUE)
+	{
+		delete mem;
+		return NULL;
+	}
+	LARGE_INTEGER size;
+	if(GetFileSizeEx(file, &size) && size.QuadPart > 0)
+		mem->mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);  // the mapping keeps the file open
+	if(mem->mapping)
+		mem->data = (const unsigned char *)MapViewOfFile(mem->mapping, FILE_MAP_READ, 0, 0, 0);
+	if(!mem->data)
+	{
+		if(mem->mapping)
+			CloseHandle(mem->mapping);
+		delete mem;
+		return NULL;
+	}
+	mem->size = size.QuadPart;
+#else
+	const int fd = open(filename, O_RDONLY);
+	if(fd < 0)
+	{
+		delete mem;
+		return NULL;
+	}
+	struct stat st;
+	void *data = MAP_FAILED;
+	if(fstat(fd, &st) == 0 && st.st_size > 0)
+		data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);  // the mapping keeps the file open
+	if(data == MAP_FAILED)
+	{
+		delete mem;
+		return NULL;
+	}
+	madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+	mem->data = (const unsigned char *)data;
+	mem->size = (long long)st.st_size;
+#endif
+	return NewIoMemory(mem);
+} // THEORAPLAYER_CreateMappedIo
+
+int THEORAPLAYER_GetFramePlanes(const THEORAPLAYER_VideoFrame* frame, THEORAPLAYER_PlanarFrame* planar)
+{
+	if(!frame || !frame->pixels || !planar)
+		return -1;
+	if(frame->format != THEORAPLAYER_VIDFMT_YV12 && frame->format != THEORAPLAYER_VIDFMT_IYUV)
+		return -1;
+
+	//same layout the converters write: full size Y, then the two quarter size chroma planes
+	const unsigned int w = frame->width;
+	const unsigned int h = frame->height;
+	const unsigned char* first = frame->pixels + (size_t)w * h;
+	const unsigned char* second = first + (size_t)(w / 2) * (h / 2);
+	planar->playms = frame->playms;
+	planar->fps = frame->fps;
+	planar->width = w;
+	planar->height = h;
+	planar->planes[0] = frame->pixels;
+	planar->planes[1] = (frame->format == THEORAPLAYER_VIDFMT_IYUV) ? first : second;
+	planar->planes[2] = (frame->format == THEORAPLAYER_VIDFMT_IYUV) ? second : first;
+	planar->strides[0] = (int)w;
+	planar->strides[1] = planar->strides[2] = (int)(w / 2);
+	return 1;
+}
+
+//libogg and libtheora state for THEORAPLAYER_BuildSeekIndex
+struct SeekIndexScan
+{
+	FILE *f = NULL;
+	ogg_sync_state sync;
+	ogg_stream_state stream;
+	int streaminit = 0;
+	th_info info;
+	th_comment comment;
+	th_setup_info *setup = NULL;
+	th_dec_ctx *dec = NULL;
+
+	SeekIndexScan()
+	{
+		ogg_sync_init(&sync);
+		th_info_init(&info);
+		th_comment_init(&comment);
+	}
+
+	~SeekIndexScan()
+	{
+		if(dec) th_decode_free(dec);
+		if(setup) th_setup_free(setup);
+		th_comment_clear(&comment);
+		th_info_clear(&info);
+		if(streaminit) ogg_stream_clear(&stream);
+		ogg_sync_clear(&sync);
+		if(f) fclose(f);
+	}
+};
+
+int THEORAPLAYER_BuildSeekIndex(const char *filename, const char *indexFilename)
+{
+	SeekIndexScan scan;
+	scan.f = fopen(filename, "rb");
+	if(!scan.f)
+		return -1;
+
+	std::vector<THEORAPLAYER_SeekIndexEntry> entries;
+	std::vector<long long> starts;  // where each packet finishing on the current page began
+	std::vector<ogg_packet> packets;
+	long long position = 0;  // file offset of the next page
+	long long carry = -1;  // page the unfinished packet at the end of the last page began on
+	int headers = 0;
+
+	ogg_page page;
+	for(;;)
+	{
+		const long result = ogg_sync_pageseek(&scan.sync, &page);
+		if(result < 0)
+		{
+			position -= result;  // skipped garbage
+			continue;
+		}
+		if(result == 0)
+		{
+			char *buffer = ogg_sync_buffer(&scan.sync, THEORAPLAYER_FILE_READAHEAD);
+			const size_t br = fread(buffer, 1, THEORAPLAYER_FILE_READAHEAD, scan.f);
+			if(br == 0)
+				break;
+			ogg_sync_wrote(&scan.sync, (long)br);
+			continue;
+		}
+		const long long offset = position;
+		position += result;
+
+		if(!scan.streaminit)
+		{
+			// the Theora identification header sits alone on the stream's first page, among the other streams' first pages
+			if(!ogg_page_bos(&page))
+				return -1;
+			ogg_packet op;
+			ogg_stream_init(&scan.stream, ogg_page_serialno(&page));
+			if(ogg_stream_pagein(&scan.stream, &page) == 0 && ogg_stream_packetout(&scan.stream, &op) == 1 &&
+				th_decode_headerin(&scan.info, &scan.comment, &scan.setup, &op) > 0)
+			{
+				scan.streaminit = 1;
+				headers = 1;
+			}
+			else
+				ogg_stream_clear(&scan.stream);
+			continue;
+		}
+		if(ogg_page_serialno(&page) != scan.stream.serialno)
+			continue;
+
+		// a packet ends at each lacing value under 255; the first one may have begun on an earlier page
+		const int segments = page.header[26];
+		const unsigned char *lacing = page.header + 27;
+		long long start = (ogg_page_continued(&page) && carry >= 0) ? carry : offset;
+		starts.clear();
+		for(int i = 0; i < segments; i++)
+		{
+			if(lacing[i] < 255)
+			{
+				starts.push_back(start);
+				start = offset;
+			}
+		}
+		carry = (segments && lacing[segments - 1] == 255) ? start : -1;
+
+		if(ogg_stream_pagein(&scan.stream, &page) < 0)
+			continue;
+		packets.clear();
+		ogg_packet op;
+		int rc;
+		while((rc = ogg_stream_packetout(&scan.stream, &op)) != 0)
+		{
+			if(rc > 0)
+				packets.push_back(op);
+		}
+		// after a hole libogg drops the leading packets, so match them up from the end of the page
+		if(packets.size() > starts.size())
+			return -1;
+		const size_t first = starts.size() - packets.size();
+
+		const ogg_int64_t granule = ogg_page_granulepos(&page);
+		for(size_t i = 0; i < packets.size(); i++)
+		{
+			if(headers < 3)
+			{
+				if(th_decode_headerin(&scan.info, &scan.comment, &scan.setup, &packets[i]) <= 0)
+					return -1;
+				if(++headers == 3)
+				{
+					scan.dec = th_decode_alloc(&scan.info, scan.setup);
+					if(!scan.dec)
+						return -1;
+				}
+				continue;
+			}
+			// only the last packet finished on a page carries the granulepos, so count back from it
+			if(granule < 0 || th_packet_iskeyframe(&packets[i]) != 1)
+				continue;
+			THEORAPLAYER_SeekIndexEntry entry;
+			entry.time = th_granule_frame(scan.dec, granule) - (ogg_int64_t)(packets.size() - 1 - i);
+			entry.offset = starts[first + i];
+			entries.push_back(entry);
+		}
+	}
+
+	if(entries.empty())
+		return -1;
+	// the whole file, including any trailing bytes that never made a page
+#if defined(_WIN32)
+	const long long filesize = _ftelli64(scan.f);
+#else
+	const long long filesize = (long long)ftello(scan.f);
+#endif
+	return THEORAPLAYER_WriteSeekIndex(indexFilename, THEORAPLAYER_SEEKINDEX_OGG, filesize, entries.data(), entries.size());
+} // THEORAPLAYER_BuildSeekIndex
+
+//Read the BOS pages at the start of the file, which come before any other page, and identify each stream
+//from its first header packet
+static int ProbeStreams(THEORAPLAYER_Decoder* ctx, THEORAPLAYER_StreamInfo* streams, int maxStreams)
+{
+	ogg_sync_state sync;
+	ogg_sync_init(&sync);
+	ogg_sync_trusted(&sync, ctx->trusted);
+	int count = 0;
+	for(;;)
+	{
+		ogg_page page;
+		const int rc = ogg_sync_pageout(&sync, &page);
+		if(rc < 0)
+			continue;  // skipped some garbage, look for the next page
+		if(rc == 0)
+		{
+			if(FeedMoreOggData(ctx, &sync, THEORAPLAYER_MIN_READ_SIZE) <= 0)
+				break;
+			continue;
+		}
+		if(!ogg_page_bos(&page))
+			break;
+
+		THEORAPLAYER_StreamInfo info = {};
+		info.serialno = ogg_page_serialno(&page);
+		info.type = THEORAPLAYER_STREAM_OTHER;
+		ogg_stream_state stream;
+		ogg_packet packet;
+		ogg_stream_init(&stream, info.serialno);
+		if(ogg_stream_pagein(&stream, &page) == 0 && ogg_stream_packetout(&stream, &packet) == 1)
+		{
+			th_info tinfo;
+			th_comment tcomment;
+			th_setup_info* tsetup = NULL;
+			vorbis_info vinfo;
+			vorbis_comment vcomment;
+			th_info_init(&tinfo);
+			th_comment_init(&tcomment);
+			vorbis_info_init(&vinfo);
+			vorbis_comment_init(&vcomment);
+			if(th_decode_headerin(&tinfo, &tcomment, &tsetup, &packet) >= 0)
+			{
+				info.type = THEORAPLAYER_STREAM_THEORA;
+				info.width = tinfo.pic_width;
+				info.height = tinfo.pic_height;
+				if(tinfo.fps_denominator != 0)
+					info.fps = ((double)tinfo.fps_numerator) / ((double)tinfo.fps_denominator);
+			}
+			else if(vorbis_synthesis_headerin(&vinfo, &vcomment, &packet) >= 0)
+			{
+				info.type = THEORAPLAYER_STREAM_VORBIS;
+				info.channels = vinfo.channels;
+				info.freq = (int)vinfo.rate;
+			}
+			if(tsetup)
+				th_setup_free(tsetup);
+			vorbis_comment_clear(&vcomment);
+			vorbis_info_clear(&vinfo);
+			th_comment_clear(&tcomment);
+			th_info_clear(&tinfo);
+		}
+		ogg_stream_clear(&stream);
+
+		if(count < maxStreams)
+			streams[count] = info;
+		count++;
+	}
+	if(ctx->io->view)
+		sync.data = NULL;  // borrowed from the Io
+	ogg_sync_clear(&sync);
+	return count;
+}
 
 TheoraPlayer::TheoraPlayer()
 {
@@ -471,12 +1725,14 @@ TheoraPlayer::TheoraPlayer()
 
 TheoraPlayer::~TheoraPlayer()
 {
-	delete _decoder;
+	StopAsync();
+	//the state refers back to the decoder
 	delete _state;
+	delete _decoder;
 	delete _io;
 }
 
-int TheoraPlayer::OpenDecode(const char* filename, THEORAPLAYER_VideoFormat outputFormat)
+int TheoraPlayer::OpenDecode(const char* filename, THEORAPLAYER_VideoFormat outputFormat, THEORAPLAYER_Allocator* allocator, unsigned int flags)
 {
 	if(_decoder)
 		return -1;
@@ -486,6 +1742,7 @@ int TheoraPlayer::OpenDecode(const char* filename, THEORAPLAYER_VideoFormat outp
 	{
 		return -1;
 	} // if
+	setvbuf(f, NULL, _IOFBF, THEORAPLAYER_FILE_READAHEAD);
 
 	if(!_io)
 	{
@@ -493,11 +1750,13 @@ int TheoraPlayer::OpenDecode(const char* filename, THEORAPLAYER_VideoFormat outp
 		_io->read = IoFopenRead;
 		_io->close = IoFopenClose;
 		_io->userdata = f;
+		_io->seek = IoFopenSeek;
+		_io->tell = IoFopenTell;
 	}
-	return OpenDecode(_io, outputFormat);
+	return OpenDecode(_io, outputFormat, allocator, flags);
 }
 
-int TheoraPlayer::OpenDecode(THEORAPLAYER_Io* io, THEORAPLAYER_VideoFormat outputFormat)
+int TheoraPlayer::OpenDecode(THEORAPLAYER_Io* io, THEORAPLAYER_VideoFormat outputFormat, THEORAPLAYER_Allocator* allocator, unsigned int flags)
 {
 	if(_decoder)
 		return -1;
@@ -528,13 +1787,144 @@ int TheoraPlayer::OpenDecode(THEORAPLAYER_Io* io, THEORAPLAYER_VideoFormat outpu
 		return -1;
 	}
 
+	if((allocator && (!allocator->alloc || !allocator->free)) || (flags & ~THEORAPLAYER_OPEN_TRUSTED))
+	{
+		io->close(io);
+		return -1;
+	}
+
 	_decoder = new THEORAPLAYER_Decoder;
 	_decoder->vidfmt = outputFormat;
 	_decoder->vidcvt = vidcvt;
 	_decoder->io = io;
+	_decoder->userallocator = allocator;
+	_decoder->trusted = (flags & THEORAPLAYER_OPEN_TRUSTED) != 0;
+	return 1;
+}
+
+int TheoraPlayer::SetConvertMode(THEORAPLAYER_ConvertMode mode)
+{
+	if(!_decoder)
+		return -1;
+	//the worker thread reads the mode on every frame while async decoding is running
+	if(_async)
+		return -1;
+	if(mode != THEORAPLAYER_CONVERT_FRAME && mode != THEORAPLAYER_CONVERT_STRIPES)
+		return -1;
+
+	_decoder->convertmode = mode;
+	return 1;
+}
+
+int TheoraPlayer::SetPostProcessingLevel(int level)
+{
+	if(!_decoder || level < 0)
+		return -1;
+
+	_decoder->pplevel = level;
+	_decoder->ppadaptive = false;
+	return 1;
+}
+int TheoraPlayer::EnableAdaptivePostProcessing(int maxLevel)
+{
+	if(!_decoder || maxLevel < 0)
+		return -1;
+
+	_decoder->pplevel = maxLevel;
+	_decoder->ppadaptive = true;
+	return 1;
+}
+int TheoraPlayer::GetPostProcessingLevel() const
+{
+	if(!_decoder)
+		return -1;
+	return _decoder->ppcurrent;
+}
+int TheoraPlayer::EnableAudio(unsigned int bufferMs)
+{
+	if(!_decoder || _state)
+		return -1;
+
+	_decoder->audiobufferms = bufferMs;
+	_decoder->audiopolicy = bufferMs ? THEORAPLAYER_AUDIO_DECODE : THEORAPLAYER_AUDIO_DISCARD;
+	return 1;
+}
+int TheoraPlayer::SetAudioPolicy(THEORAPLAYER_AudioPolicy policy)
+{
+	if(!_decoder || _state)
+		return -1;
+	if(policy != THEORAPLAYER_AUDIO_DECODE && policy != THEORAPLAYER_AUDIO_DISCARD && policy != THEORAPLAYER_AUDIO_IGNORE)
+		return -1;
+
+	_decoder->audiopolicy = policy;
 	return 1;
 }
 
+int TheoraPlayer::SetMaxReadSize(unsigned int bytes)
+{
+	if(!_decoder)
+		return -1;
+	//the worker thread updates the read size from the page and packet averages while async decoding is running
+	if(_async)
+		return -1;
+	if(bytes < THEORAPLAYER_MIN_READ_SIZE || bytes > LONG_MAX / 2)
+		return -1;
+
+	_decoder->maxreadsize = (long)bytes;
+	_decoder->UpdateReadSize();
+	return 1;
+}
+
+int TheoraPlayer::GetIoStats(THEORAPLAYER_IoStats* stats) const
+{
+	if(!_decoder || !stats)
+		return -1;
+
+	stats->bytesRead = _decoder->iobytes.load(std::memory_order_relaxed);
+	stats->reads = _decoder->ioreads.load(std::memory_order_relaxed);
+	stats->seconds = _decoder->ionanoseconds.load(std::memory_order_relaxed) * 1e-9;
+	stats->readSize = (unsigned int)_decoder->readsize.load(std::memory_order_relaxed);
+	stats->bytesCompacted = _decoder->iocompacted.load(std::memory_order_relaxed);
+	return 1;
+}
+
+int TheoraPlayer::ListStreams(THEORAPLAYER_StreamInfo* streams, int maxStreams)
+{
+	if(!_decoder || _state)
+		return -1;
+	if(maxStreams > 0 && !streams)
+		return -1;
+	THEORAPLAYER_Io* io = _decoder->io;
+	if(!io->seek || !io->tell)
+		return -1;
+
+	const long long start = io->tell(io);
+	if(start < 0)
+		return -1;
+	const int count = ProbeStreams(_decoder, streams, maxStreams);
+	//Prepare reads the same pages again
+	if(io->seek(io, start, SEEK_SET) < 0)
+		return -1;
+	return count;
+}
+int TheoraPlayer::SelectVideoStream(int serialno)
+{
+	if(!_decoder || _state)
+		return -1;
+
+	_decoder->selectvideo = true;
+	_decoder->videoserial = serialno;
+	return 1;
+}
+int TheoraPlayer::SelectAudioStream(int serialno)
+{
+	if(!_decoder || _state)
+		return -1;
+
+	_decoder->selectaudio = true;
+	_decoder->audioserial = serialno;
+	return 1;
+}
 int TheoraPlayer::Prepare()
 {
 	//decoder should exist (OpenDecode has been called) but state should not because we will create it
@@ -543,11 +1933,36 @@ int TheoraPlayer::Prepare()
 	if(_state)
 		return -1;
 
+	//remember where the headers start, so a failed Prepare can be retried with other streams selected
+	THEORAPLAYER_Io* io = _decoder->io;
+	const long long start = (io->seek && io->tell) ? io->tell(io) : -1;
+
 	//FIXME: Use a user-supplied allocator
 	_state = new THEORAPLAYER_State;
 	_state->ctx = _decoder;
 	auto result = _state->Prepare();
-	if(!result)
+	//Prepare returns -1 on every failure, leaving a half-built state behind
+	if(result <= 0)
+	{
+		delete _state;
+		_state = nullptr;
+		if(start >= 0)
+			io->seek(io, start, SEEK_SET);
+	}
+	return result;
+}
+
+int TheoraPlayer::SeekToMs(unsigned int ms)
+{
+	if(!_state)
+		return -1;
+	//the worker thread owns the decoder while async decoding is running
+	if(_async)
+		return -1;
+
+	auto result = _state->Seek(ms);
+	//a failed seek leaves the streams in an unknown place, same as a decode error
+	if(result < 0)
 	{
 		delete _state;
 		_state = nullptr;
@@ -555,10 +1970,49 @@ int TheoraPlayer::Prepare()
 	return result;
 }
 
+int TheoraPlayer::LoadSeekIndex(const char* filename)
+{
+	if(!_decoder || !filename)
+		return -1;
+
+	unsigned char* data = NULL;
+	size_t size = 0;
+	if(THEORAPLAYER_ReadSeekIndex(filename, &data, &size) < 0)
+		return -1;
+	if(LoadSeekIndex(data, size) < 0)
+	{
+		delete[] data;
+		return -1;
+	}
+	delete[] _decoder->seekindexdata;
+	_decoder->seekindexdata = data;
+	return 1;
+}
+
+int TheoraPlayer::LoadSeekIndex(const void* data, size_t size)
+{
+	if(!_decoder)
+		return -1;
+	//sizing the file moves the Io, which the worker thread owns while async decoding is running
+	if(_async)
+		return -1;
+
+	const THEORAPLAYER_SeekIndexEntry* entries = NULL;
+	size_t count = 0;
+	if(THEORAPLAYER_OpenSeekIndex(data, size, THEORAPLAYER_SEEKINDEX_OGG, _decoder->IoSize(), &entries, &count) < 0)
+		return -1;
+	_decoder->seekindex = entries;
+	_decoder->seekindexcount = count;
+	return 1;
+}
+
 int TheoraPlayer::GetVideoFrame(THEORAPLAYER_VideoFrame* frame)
 {
 	if(!_state)
 		return -1;
+	//the worker thread owns the decoder while async decoding is running
+	if(_async)
+		return -1;
 	if(!frame)
 		return -1;
 
@@ -573,15 +2027,224 @@ int TheoraPlayer::GetVideoFrame(THEORAPLAYER_VideoFrame* frame)
 	return result;
 }
 
-//FIXME: Use a user-supplied allocator
+int TheoraPlayer::SkipVideoFrame()
+{
+	if(!_state)
+		return -1;
+	if(_async)
+		return -1;
+
+	auto result = _state->DecodeNextVideoFrame(nullptr);
+	//Same as GetVideoFrame, a decode error is the end of this player
+	if(result < 0)
+	{
+		delete _state;
+		_state = nullptr;
+		return -1;
+	}
+	return result;
+}
+
+int TheoraPlayer::GetPlanarFrame(THEORAPLAYER_PlanarFrame* frame)
+{
+	if(!_state)
+		return -1;
+	if(_async)
+		return -1;
+	if(!frame)
+		return -1;
+
+	auto result = _state->DecodeNextVideoFrame(nullptr, frame);
+	//Same as GetVideoFrame, a decode error is the end of this player
+	if(result < 0)
+	{
+		delete _state;
+		_state = nullptr;
+		return -1;
+	}
+	return result;
+}
 void TheoraPlayer::FreeFrameData(THEORAPLAYER_VideoFrame* frame)
 {
-	delete frame->pixels;
+	if(!_decoder || !frame)
+		return;
+	_decoder->Free(frame->pixels);
+	frame->pixels = nullptr;
+}
+
+THEORAPLAYER_VideoFrame* TheoraPlayer::AllocFrame()
+{
+	if(!_decoder || !_state)
+		return nullptr;
+
+	{
+		std::lock_guard<std::mutex> guard(_decoder->poollock);
+		if(!_decoder->pool.empty())
+		{
+			VideoFrame* frame = _decoder->pool.back();
+			_decoder->pool.pop_back();
+			return frame;
+		}
+	}
+
+	VideoFrame* frame = new VideoFrame();
+	if(_state->AllocateFrame(frame) < 0)
+	{
+		delete frame;
+		return nullptr;
+	}
+	return frame;
+}
+
+void TheoraPlayer::RecycleFrame(THEORAPLAYER_VideoFrame* frame)
+{
+	if(!_decoder || !frame)
+		return;
+
+	std::lock_guard<std::mutex> guard(_decoder->poollock);
+	_decoder->pool.push_back(frame);
+}
+
+int TheoraPlayer::StartAsync(unsigned int queueDepth, THEORAPLAYER_Clock* clock)
+{
+	if(!_state || _async)
+		return -1;
+	if(queueDepth == 0)
+		return -1;
+	if(clock && !clock->now)
+		return -1;
+
+	_async = new THEORAPLAYER_Async;
+	_async->state = _state;
+	_async->clock = clock;
+	_async->frames.resize(queueDepth, VideoFrame());
+	for(auto& frame : _async->frames)
+	{
+		if(_state->AllocateFrame(&frame) < 0)
+		{
+			StopAsync();
+			return -1;
+		}
+	}
+	_async->worker = std::thread(&THEORAPLAYER_Async::Run, _async);
+	return 1;
+}
+
+void TheoraPlayer::StopAsync()
+{
+	delete _async;
+	_async = nullptr;
+}
+
+int TheoraPlayer::TryAcquireFrame(const THEORAPLAYER_VideoFrame** frame)
+{
+	if(!_async || !frame)
+		return -1;
+
+	if(_async->acquired == _async->written.load(std::memory_order_acquire))
+	{
+		if(_async->error.load())
+			return -1;
+		if(!_async->finished.load())
+			_async->underruns.fetch_add(1, std::memory_order_relaxed);
+		return 0;
+	}
+
+	*frame = &_async->frames[_async->acquired % _async->frames.size()];
+	_async->acquired++;
+	return 1;
+}
+
+int TheoraPlayer::ReleaseFrame(const THEORAPLAYER_VideoFrame* frame)
+{
+	if(!_async || !frame)
+		return -1;
+
+	//frames have to come back in the order they went out
+	const unsigned int released = _async->released.load(std::memory_order_relaxed);
+	if(released == _async->acquired || frame != &_async->frames[released % _async->frames.size()])
+		return -1;
+
+	{
+		std::lock_guard<std::mutex> guard(_async->lock);
+		_async->released.store(released + 1, std::memory_order_release);
+	}
+	_async->wake.notify_one();
+	return 1;
+}
+
+int TheoraPlayer::GetAsyncStats(THEORAPLAYER_AsyncStats* stats) const
+{
+	if(!_async || !stats)
+		return -1;
+
+	stats->queueDepth = _async->written.load(std::memory_order_acquire) - _async->acquired;
+	stats->queueCapacity = (unsigned int)_async->frames.size();
+	stats->framesDecoded = _async->written.load(std::memory_order_relaxed);
+	stats->underruns = _async->underruns.load(std::memory_order_relaxed);
+	stats->framesOnTime = _async->ontime.load(std::memory_order_relaxed);
+	stats->framesLate = _async->late.load(std::memory_order_relaxed);
+	stats->framesDropped = _async->dropped.load(std::memory_order_relaxed);
+	return 1;
 }
 
 int TheoraPlayer::IsDecoding() const
 {
-	if(_decoder && _state && !_state->eos)
+	//in async mode, frames still sitting in the queue count as decoding
+	if(_async)
+		return (!_async->finished.load(std::memory_order_acquire) || _async->acquired != _async->written.load(std::memory_order_acquire)) ? 1 : 0;
+
+	//with audio enabled, the video may end before the last of the audio fits in the ring
+	if(_decoder && _state && (!_state->eos || _state->AudioPending()))
 		return 1;
 	return 0;
 }
+
+int TheoraPlayer::GetAudioInfo(int* channels, int* freq) const
+{
+	if(!_decoder || !_decoder->audiochannels)
+		return 0;
+
+	if(channels)
+		*channels = _decoder->audiochannels;
+	if(freq)
+		*freq = _decoder->audiofreq;
+	return 1;
+}
+
+int TheoraPlayer::GetAudioPacket(THEORAPLAYER_AudioPacket* packet)
+{
+	if(!packet || !packet->samples)
+		return -1;
+	if(!_decoder || !_decoder->audio.capacity)
+	{
+		packet->frames = 0;
+		return -1;
+	}
+
+	THEORAPLAYER_AudioRing& ring = _decoder->audio;
+	unsigned long long position = 0;
+	packet->frames = ring.Read(packet->samples, packet->frames, &position);
+	packet->channels = ring.channels;
+	packet->freq = ring.freq;
+	packet->playms = (unsigned int)((ring.base + position) * 1000 / ring.freq);
+	packet->next = nullptr;
+	return packet->frames > 0 ? 1 : 0;
+}
+
+int TheoraPlayer::ReadAudio(float* samples, int frames)
+{
+	if(!samples || frames < 0)
+		return -1;
+	if(!_decoder || !_decoder->audio.capacity)
+		return -1;
+
+	return _decoder->audio.Read(samples, frames, nullptr);
+}
+
+unsigned int TheoraPlayer::GetAudioBuffered() const
+{
+	if(!_decoder || !_decoder->audio.capacity)
+		return 0;
+	return _decoder->audio.Available();
+}
@@ -24,18 +24,56 @@
 //This code is derived from Ryan C. Gordon's TheoraPlay:
 //https://www.icculus.org/theoraplay/
 //This is mostly a C++ rework, cleaned up for general ease of use, and with threading delegated to the caller
+//(StartAsync provides an optional decode thread for callers that do not want to manage their own)
 
 #ifndef THEORAPLAYER_H
 #define THEORAPLAYER_H
 #pragma once
 
+#include <cstddef>
+
+//Caller-implemented stream. The player calls every hook that isn't NULL, so hooks that aren't implemented must be
+//NULL: start from THEORAPLAYER_InitIo or a value-initialized struct (THEORAPLAYER_Io io = {}), as the built-in Ios do.
 struct THEORAPLAYER_Io
 {
 	size_t(*read)(THEORAPLAYER_Io *io, void *buf, long buflen);
 	void(*close)(THEORAPLAYER_Io *io);
 	void *userdata;
+	//Optional, needed for seeking. seek takes SEEK_SET/SEEK_CUR/SEEK_END and returns 0 on success, like fseek.
+	int(*seek)(THEORAPLAYER_Io *io, long long offset, int whence);
+	long long(*tell)(THEORAPLAYER_Io *io);
+	//Optional total size in bytes, saves a seek to the end
+	long long(*size)(THEORAPLAYER_Io *io);
+	//Optional zero-copy read: consume up to maxlen bytes and return a pointer to them instead of copying.
+	//The memory must stay valid and unchanged until close, and successive views must be adjacent in memory.
+	const void*(*view)(THEORAPLAYER_Io *io, long maxlen, long *len);
+};
+
+//Clear every hook and the userdata, so an Io that only fills in read and close never has the optional hooks called
+void THEORAPLAYER_InitIo(THEORAPLAYER_Io* io);
+
+//Built-in Io over a caller-owned buffer, which must outlive the player. Seekable, and demuxes without copying.
+//OpenDecode takes ownership of the returned Io; if it is never passed in, call io->close(io).
+THEORAPLAYER_Io* THEORAPLAYER_CreateMemoryIo(const void* data, size_t size);
+//Built-in Io over a read-only memory mapping of a file, with the same properties. Returns NULL if the file can't be mapped.
+THEORAPLAYER_Io* THEORAPLAYER_CreateMappedIo(const char* filename);
+
+//Scan an Ogg Theora file and write an index of its keyframes to indexFilename, for LoadSeekIndex.
+//Returns 1 on success, -1 if the file can't be read or has no Theora stream.
+int THEORAPLAYER_BuildSeekIndex(const char* filename, const char* indexFilename);
+
+//User-supplied allocator for frame pixel data, e.g. to place frames in mapped GPU upload memory.
+//alloc must return memory aligned to at least the requested alignment (a power of two), or NULL.
+struct THEORAPLAYER_Allocator
+{
+	void*(*alloc)(THEORAPLAYER_Allocator *allocator, size_t size, size_t alignment);
+	void(*free)(THEORAPLAYER_Allocator *allocator, void *ptr);
+	void *userdata;
 };
 
+//Alignment of frame pixel data, enough for SIMD loads and stores on every supported path
+#define THEORAPLAYER_FRAME_ALIGNMENT 64
+
 /* YV12 is YCrCb, not YCbCr; that's what SDL uses for YV12 overlays. */
 enum THEORAPLAYER_VideoFormat
 {
@@ -47,6 +85,51 @@ enum THEORAPLAYER_VideoFormat
 	THEORAPLAYER_VIDFMT_BGRA   /* 32 bits packed pixel BGRA (full alpha). */
 };
 
+//How decoded video gets converted into the output frame
+enum THEORAPLAYER_ConvertMode
+{
+	THEORAPLAYER_CONVERT_FRAME,   /* convert the whole frame after it has been decoded */
+	THEORAPLAYER_CONVERT_STRIPES  /* convert each band of rows as soon as the decoder finishes it, while it is still in cache */
+};
+
+//Options for OpenDecode
+enum THEORAPLAYER_OpenFlags
+{
+	THEORAPLAYER_OPEN_DEFAULT = 0,
+	THEORAPLAYER_OPEN_TRUSTED = 1  /* integrity is guaranteed elsewhere (a signed pak, say): pages are framed but their CRCs aren't checked */
+};
+
+//What happens to the Vorbis stream
+enum THEORAPLAYER_AudioPolicy
+{
+	THEORAPLAYER_AUDIO_DECODE,   /* decode it into the audio ring for ReadAudio/GetAudioPacket */
+	THEORAPLAYER_AUDIO_DISCARD,  /* read its headers for GetAudioInfo, then drop its pages unparsed (the default) */
+	THEORAPLAYER_AUDIO_IGNORE    /* don't look for it at all */
+};
+
+//Kind of logical stream in an Ogg file
+enum THEORAPLAYER_StreamType
+{
+	THEORAPLAYER_STREAM_THEORA,
+	THEORAPLAYER_STREAM_VORBIS,
+	THEORAPLAYER_STREAM_OTHER
+};
+
+//One logical stream, as listed by ListStreams
+struct THEORAPLAYER_StreamInfo
+{
+	//Ogg serial number, for SelectVideoStream/SelectAudioStream
+	int serialno;
+	THEORAPLAYER_StreamType type;
+	//Picture size and framerate of a Theora stream
+	unsigned int width;
+	unsigned int height;
+	double fps;
+	//Channel count and sample rate of a Vorbis stream
+	int channels;
+	int freq;
+};
+
 //Structure to hold one video frame, both metadata and pixel data
 struct THEORAPLAYER_VideoFrame
 {
@@ -60,10 +143,31 @@ struct THEORAPLAYER_VideoFrame
 	unsigned int height;
 	//Pixel format of this frame
 	THEORAPLAYER_VideoFormat format;
-	//Pixel data of this frame (owned by this struct)
+	//Pixel data of this frame (owned by this struct, allocated with the player's allocator)
 	unsigned char *pixels;
 };
 
+//Y, Cb and Cr planes of a 4:2:0 frame, for uploading to three textures and converting in a shader
+struct THEORAPLAYER_PlanarFrame
+{
+	//The timestamp of this frame
+	unsigned int playms;
+	//Playback framerate for this frame
+	double fps;
+	//Image width of this frame; the chroma planes are half as wide
+	unsigned int width;
+	//Image height of this frame; the chroma planes are half as tall
+	unsigned int height;
+	//Top row of each plane and the distance in bytes from one row to the next
+	const unsigned char* planes[3];
+	int strides[3];
+};
+
+//Views of the planes in a YV12 or IYUV frame's pixels, in Y, Cb, Cr order either way. Returns -1 for the packed formats.
+int THEORAPLAYER_GetFramePlanes(const THEORAPLAYER_VideoFrame* frame, THEORAPLAYER_PlanarFrame* planar);
+
+//Block of interleaved audio read out of the player's ring.
+//The caller supplies samples and sets frames to its capacity; GetAudioPacket fills in the rest.
 struct THEORAPLAYER_AudioPacket
 {
 	unsigned int playms;  /* playback start time in milliseconds. */
@@ -74,29 +178,160 @@ struct THEORAPLAYER_AudioPacket
 	struct THEORAPLAYER_AudioPacket *next;
 };
 
+//Counters for the asynchronous decode queue
+struct THEORAPLAYER_AsyncStats
+{
+	//Decoded frames waiting to be acquired
+	unsigned int queueDepth;
+	//Number of frames in the ring
+	unsigned int queueCapacity;
+	//Total frames decoded by the worker thread
+	unsigned int framesDecoded;
+	//TryAcquireFrame calls that found nothing ready while the stream was still decoding
+	unsigned int underruns;
+	//Only counted with a clock: frames queued before their playms, frames queued after it,
+	//and frames decoded without output because the frame after them was already due
+	unsigned int framesOnTime;
+	unsigned int framesLate;
+	unsigned int framesDropped;
+};
+
+//Playback clock for the async scheduler
+struct THEORAPLAYER_Clock
+{
+	//Current playback position in milliseconds, on the same timeline as playms. Called from the worker thread.
+	unsigned int(*now)(THEORAPLAYER_Clock *clock);
+	void *userdata;
+};
+
+//Counters for the player's Io
+struct THEORAPLAYER_IoStats
+{
+	//Bytes handed to the demuxer
+	unsigned long long bytesRead;
+	//Calls to the Io's read or view
+	unsigned long long reads;
+	//Time spent inside those calls
+	double seconds;
+	//Current adaptive read size in bytes
+	unsigned int readSize;
+	//Bytes libogg has moved to the front of its sync and stream buffers to make room
+	unsigned long long bytesCompacted;
+};
+
 class TheoraPlayer
 {
 public:
 	TheoraPlayer();
 	~TheoraPlayer();
 
-	//Open a video file by name for decode to the specified output format
-	int OpenDecode(const char* filename, THEORAPLAYER_VideoFormat outputFormat);
+	//Open a video file by name for decode to the specified output format.
+	//Frame pixels come from the allocator if one is supplied (it must outlive the player), or aligned malloc otherwise.
+	//flags is a combination of THEORAPLAYER_OpenFlags.
+	int OpenDecode(const char* filename, THEORAPLAYER_VideoFormat outputFormat, THEORAPLAYER_Allocator* allocator = nullptr, unsigned int flags = THEORAPLAYER_OPEN_DEFAULT);
 	//Open a video file with user-supplied IO for decode to the specified output format
-	int OpenDecode(THEORAPLAYER_Io* io, THEORAPLAYER_VideoFormat outputFormat);
+	int OpenDecode(THEORAPLAYER_Io* io, THEORAPLAYER_VideoFormat outputFormat, THEORAPLAYER_Allocator* allocator = nullptr, unsigned int flags = THEORAPLAYER_OPEN_DEFAULT);
 	
-	//Begin decoding from the start of the video
+	//Select how decoded frames are converted to the output format. Takes effect on the next decoded frame.
+	//Fails while async decoding runs.
+	int SetConvertMode(THEORAPLAYER_ConvertMode mode);
+
+	//Deblocking and deringing of the decoded picture, from 0 (off, the default) up to 7, clamped to what libtheora supports.
+	//Safe to call from any thread, including while async decoding runs; takes effect on the next decoded frame.
+	//Turns off adaptive post-processing.
+	int SetPostProcessingLevel(int level);
+	//Let the player move the level between 0 and maxLevel from how long frames take to decode against the frame
+	//budget (1/fps): lowered while decoding takes over half the budget, raised again while it takes under a quarter.
+	int EnableAdaptivePostProcessing(int maxLevel);
+	//Level used for the last decoded frame, -1 before Prepare
+	int GetPostProcessingLevel() const;
+
+	//Decode the Vorbis stream into a ring holding bufferMs of audio, selecting THEORAPLAYER_AUDIO_DECODE. Call before Prepare.
+	//The ring is filled as a side effect of GetVideoFrame (or the async worker) and drained with ReadAudio/GetAudioPacket.
+	//Audio that is never read backs up in the Ogg stream, so a caller that won't drain it should pick another policy.
+	int EnableAudio(unsigned int bufferMs);
+	//Choose what happens to the Vorbis stream. Call before Prepare. Anything but decoding keeps its pages out of the
+	//demuxer, so memory stays flat however long the video plays. THEORAPLAYER_AUDIO_DECODE without EnableAudio uses a 1 second ring.
+	int SetAudioPolicy(THEORAPLAYER_AudioPolicy policy);
+
+	//Ceiling for the read size, which otherwise grows to fit the stream's page and frame sizes. Default 256KB, minimum 4KB.
+	//Fails while async decoding runs.
+	int SetMaxReadSize(unsigned int bytes);
+	//Snapshot of the Io counters. Counts accumulate over the life of the player.
+	int GetIoStats(THEORAPLAYER_IoStats* stats) const;
+
+	//List the file's logical streams in the order they start. Call after OpenDecode and before Prepare; needs an Io
+	//with seek and tell, to go back to where it started. Returns the number of streams, which may be more than maxStreams.
+	int ListStreams(THEORAPLAYER_StreamInfo* streams, int maxStreams);
+	//Decode the Theora or Vorbis stream with this serial number instead of the first one. Call before Prepare.
+	//Pages of every stream that isn't decoded are dropped as soon as they are read. Seek indexes describe the first
+	//Theora stream, so don't load one with another stream selected.
+	int SelectVideoStream(int serialno);
+	int SelectAudioStream(int serialno);
+
+	//Begin decoding from the start of the video. A file without a Vorbis stream plays as video only.
+	//Fails if a selected stream isn't in the file. After a failure nothing is decoding; with an Io that has seek and tell
+	//it is back where it started, so other streams can be selected and Prepare called again.
 	int Prepare();
 	//True if we are currently in the midst of decoding this video and not at the end of the stream
 	int IsDecoding() const;
+	//Jump so the next decoded frame is the first one with playms >= ms. Needs an Io with seek and tell.
+	//Lands on the keyframe before the target and decodes forward without output. Returns 0 if ms is past the end.
+	//Not available while async decoding is running. With audio enabled, the audio ring is reset, so don't read audio during the call.
+	int SeekToMs(unsigned int ms);
+	//Seek with an index from THEORAPLAYER_BuildSeekIndex: one jump straight to the keyframe instead of a search of the file.
+	//Call after OpenDecode. An index built from a different file size is refused with -1.
+	int LoadSeekIndex(const char* filename);
+	//Same, with the index already in memory. It is used in place without a copy, so a mapping of the index file
+	//(THEORAPLAYER_CreateMappedIo's view) costs nothing to load. The memory must outlive the player.
+	int LoadSeekIndex(const void* data, size_t size);
 	//Decode the next frame and save the data to the supplied frame. If the frame does not have pixel data, one will be allocated.
 	int GetVideoFrame(THEORAPLAYER_VideoFrame* frame);
+	//Decode the next frame only to advance the decoder, which later frames predict from. Nothing is converted
+	//or post-processed. Returns 1 if a frame was skipped, with the same 0 and -1 results as GetVideoFrame.
+	int SkipVideoFrame();
+	//Decode the next frame and point the planes straight into the decoder's picture, with no conversion or copy.
+	//They stay valid until the next call that decodes or seeks. Returns 1 with a frame, with the same 0 and -1
+	//results as GetVideoFrame.
+	int GetPlanarFrame(THEORAPLAYER_PlanarFrame* frame);
 	//Free the previously allocated pixel data inside this frame.
 	void FreeFrameData(THEORAPLAYER_VideoFrame* frame);
 
+	//Get a frame with pixel storage from the player's pool, allocating only when the pool is empty. Call after Prepare.
+	THEORAPLAYER_VideoFrame* AllocFrame();
+	//Return a frame from AllocFrame to the pool for reuse. Safe to call from any thread.
+	void RecycleFrame(THEORAPLAYER_VideoFrame* frame);
+
+	//Start decoding on a worker thread into a ring of queueDepth preallocated frames. Call after Prepare.
+	//While the worker runs, use TryAcquireFrame/ReleaseFrame instead of GetVideoFrame, SkipVideoFrame and GetPlanarFrame.
+	//With a clock (which must outlive the worker), frames that would be replaced before they could be shown
+	//are decoded without conversion or post-processing and never queued, so a slow stream catches up cheaply.
+	int StartAsync(unsigned int queueDepth, THEORAPLAYER_Clock* clock = nullptr);
+	//Stop the worker thread and free the frame ring. Decoding can continue synchronously afterwards.
+	void StopAsync();
+	//Never blocks. Returns 1 and the oldest decoded frame, 0 if no frame is ready yet, -1 on a decode error.
+	//Frames stay valid until released, and must be released in the order they were acquired.
+	int TryAcquireFrame(const THEORAPLAYER_VideoFrame** frame);
+	//Hand an acquired frame back to the worker thread for reuse
+	int ReleaseFrame(const THEORAPLAYER_VideoFrame* frame);
+	//Snapshot of the async queue counters
+	int GetAsyncStats(THEORAPLAYER_AsyncStats* stats) const;
+
+	//Channel count and sample rate of the Vorbis stream, decoded or discarded. Returns 0 if there is none. Call after Prepare.
+	int GetAudioInfo(int* channels, int* freq) const;
+	//The audio functions below never lock or allocate, so they can be called from an audio callback.
+	//Only one thread may read audio at a time; it does not need to be the decoding thread.
+	//Read up to packet->frames interleaved frames into packet->samples. Returns 1 if any were read, 0 if the ring is empty.
+	int GetAudioPacket(THEORAPLAYER_AudioPacket* packet);
+	//Read up to frames interleaved frames into samples. Returns the number of frames read.
+	int ReadAudio(float* samples, int frames);
+	//Number of audio frames decoded and waiting in the ring
+	unsigned int GetAudioBuffered() const;
+
 private:
 	struct THEORAPLAYER_Decoder* _decoder = nullptr;
 	struct THEORAPLAYER_State* _state = nullptr;
+	struct THEORAPLAYER_Async* _async = nullptr;
 	THEORAPLAYER_Io* _io = nullptr;
 };
 
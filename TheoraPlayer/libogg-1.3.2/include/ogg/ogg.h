@@ -82,6 +82,10 @@ typedef struct {
                              layer) also knows about the gap */
   ogg_int64_t   granulepos;
 
+  ogg_int64_t   compacted; /* bytes of body, lacing and granule data
+                              ogg_stream_pagein has moved to the front
+                              of their arrays, for profiling */
+
 } ogg_stream_state;
 
 /* ogg_packet is used to encapsulate the data and metadata belonging
@@ -111,6 +115,11 @@ typedef struct {
   int unsynced;
   int headerbytes;
   int bodybytes;
+
+  int trusted;    /* skip CRC verification; see ogg_sync_trusted */
+
+  ogg_int64_t compacted; /* bytes ogg_sync_buffer has moved to the front
+                            of data, for profiling */
 } ogg_sync_state;
 
 /* Ogg BITSTREAM PRIMITIVES: bitstream ************************/
@@ -170,6 +179,7 @@ extern int      ogg_sync_clear(ogg_sync_state *oy);
 extern int      ogg_sync_reset(ogg_sync_state *oy);
 extern int      ogg_sync_destroy(ogg_sync_state *oy);
 extern int      ogg_sync_check(ogg_sync_state *oy);
+extern int      ogg_sync_trusted(ogg_sync_state *oy, int trusted);
 
 extern char    *ogg_sync_buffer(ogg_sync_state *oy, long size);
 extern int      ogg_sync_wrote(ogg_sync_state *oy, long bytes);
@@ -191,6 +201,19 @@ extern int      ogg_stream_eos(ogg_stream_state *os);
 
 extern void     ogg_page_checksum_set(ogg_page *og);
 
+/* CRC engine for page checksums and verification.  All engines give
+   the same checksums.  The fastest available one is picked on first
+   use; call ogg_crc_engine before any decoding starts to choose
+   another.  It returns the engine now in use, or -1 if the requested
+   one is not available on this CPU or build. */
+#define OGG_CRC_AUTO     0
+#define OGG_CRC_BYTEWISE 1
+#define OGG_CRC_SLICE8   2
+#define OGG_CRC_PCLMUL   3
+
+extern int      ogg_crc_engine(int engine);
+extern int      ogg_crc_engine_current(void);
+
 extern int      ogg_page_version(const ogg_page *og);
 extern int      ogg_page_continued(const ogg_page *og);
 extern int      ogg_page_bos(const ogg_page *og);
@@ -0,0 +1,44 @@
+// Copyright (c) Promit Roy.
+// All rights reserved.
+//
+// This code is licensed under the MIT License.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+// Y'CbCr to RGB for the three plane textures, in place of the CPU conversion and texture.frag.
+// Same math as ColorConvert.cpp: the Theora 1.1 spec, chapter 4.2, with kr = 0.299 and kb = 0.114
+// and video range levels (luma 16-235, chroma 16-240).
+#version 330 core
+in vec3 ourColor;
+in vec2 TexCoord;
+
+out vec4 color;
+
+// One single channel texture per plane; the chroma ones are half size and filtered up
+uniform sampler2D planeY;
+uniform sampler2D planeCb;
+uniform sampler2D planeCr;
+
+void main()
+{
+    float y = (texture(planeY, TexCoord).r - 16.0 / 255.0) * (255.0 / 219.0);
+    float cb = texture(planeCb, TexCoord).r - 128.0 / 255.0;
+    float cr = texture(planeCr, TexCoord).r - 128.0 / 255.0;
+    color = vec4(y + 1.596 * cr, y - 0.392 * cb - 0.813 * cr, y + 2.017 * cb, 1.0);
+}
\ No newline at end of file
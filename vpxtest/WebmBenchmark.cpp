@@ -0,0 +1,842 @@
+// Copyright (c) Promit Roy.
+// All rights reserved.
+//
+// This code is licensed under the MIT License.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+//Command line benchmarks for WebmPlayer. Build this file together with WebmPlayer.cpp,
+//TheoraPlayer/ColorConvert.cpp, TheoraPlayer/SeekIndex.cpp, nestegg and libvpx, in place of webm.cpp.
+//
+//  WebmBenchmark threads file.webm [maxthreads iterations]
+//  WebmBenchmark packets file.webm [more.webm ...]   (allocations and Io callbacks per packet)
+//  WebmBenchmark seek [file.webm ...]   (cue lookup latency, plus synthetic files with up to 100000 cues)
+//  WebmBenchmark seekindex file.webm [seeks]   (player seeks through cues or clusters against a seek index)
+//  WebmBenchmark skip file.webm [every]   (skipped frames against converted ones)
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "WebmPlayer.h"
+#include "ColorConvert.h"
+
+extern "C" {
+#include "nestegg/nestegg.h"
+}
+
+static double Seconds()
+{
+	using namespace std::chrono;
+	return duration_cast<duration<double>>(high_resolution_clock::now().time_since_epoch()).count();
+}
+
+//FNV-1a over the pixels, to check that every thread setting produces the same frames
+static void HashFrame(const THEORAPLAYER_VideoFrame& frame, unsigned long long& hash)
+{
+	const int bpp = THEORAPLAYER_BytesPerPixel(frame.format);
+	const size_t size = bpp ? (size_t)frame.width * frame.height * bpp
+		: (size_t)frame.width * frame.height + 2 * (size_t)(frame.width / 2) * (frame.height / 2);
+	for(size_t i = 0; i < size; ++i)
+		hash = (hash ^ frame.pixels[i]) * 1099511628211ull;
+	hash = (hash ^ frame.playms) * 1099511628211ull;
+}
+
+//Decode a whole file as fast as possible. Returns the frame count, or -1 on failure.
+static int DecodeFile(const char* filename, unsigned int threads, WEBMPLAYER_ThreadMode mode, double& seconds, unsigned long long& hash)
+{
+	WebmPlayer player;
+	if(player.OpenDecode(filename, THEORAPLAYER_VIDFMT_IYUV) < 0)
+		return -1;
+	if(player.SetThreads(threads, mode) < 0)
+		return -1;
+
+	const double start = Seconds();
+	if(player.Prepare() < 0)
+		return -1;
+	THEORAPLAYER_VideoFrame frame = {};
+	int frames = 0;
+	int result;
+	hash = 14695981039346656037ull;
+	while((result = player.GetVideoFrame(&frame)) > 0)
+	{
+		++frames;
+		HashFrame(frame, hash);
+	}
+	seconds = Seconds() - start;
+	player.FreeFrameData(&frame);
+	return result < 0 ? -1 : frames;
+}
+
+static int BenchThreads(int argc, char** argv)
+{
+	const char* filename = argv[0];
+	const unsigned int cores = std::max(std::thread::hardware_concurrency(), 1u);
+	const unsigned int maxthreads = argc > 1 ? (unsigned int)atoi(argv[1]) : std::min(cores, 8u);
+	const int iterations = argc > 2 ? atoi(argv[2]) : 3;
+	const WEBMPLAYER_ThreadMode modes[] = { WEBMPLAYER_THREADS_ROWS, WEBMPLAYER_THREADS_FRAMES };
+	const char* modenames[] = { "rows", "frames" };
+
+	printf("%s, %u cores, best of %d, IYUV output\n", filename, cores, iterations);
+	unsigned long long reference = 0;
+	int failures = 0;
+	double single = 0.0;
+	// threads 0 is the automatic choice
+	for(unsigned int threads = 0; threads <= maxthreads; ++threads)
+	{
+		for(int m = 0; m < 2; ++m)
+		{
+			if(threads < 2 && m > 0)
+				continue;
+			double best = 1e30;
+			int frames = 0;
+			unsigned long long hash = 0;
+			for(int i = 0; i < iterations; ++i)
+			{
+				double seconds = 0.0;
+				frames = DecodeFile(filename, threads, modes[m], seconds, hash);
+				if(frames < 0)
+				{
+					printf("failed to decode %s\n", filename);
+					return 1;
+				}
+				best = std::min(best, seconds);
+			}
+			if(!reference)
+				reference = hash;
+			if(hash != reference)
+				++failures;
+			if(threads == 1)
+				single = best;
+			char label[32];
+			if(threads)
+				snprintf(label, sizeof(label), "%u", threads);
+			else
+				snprintf(label, sizeof(label), "auto");
+			printf("  threads %-4s %-6s %4d frames %8.1f fps %7.3f ms/frame", label, modenames[m], frames,
+				frames / best, best * 1000.0 / frames);
+			if(single > 0.0 && threads > 1)
+				printf("  (%.2fx)", single / best);
+			printf("%s\n", hash == reference ? "" : "  MISMATCH");
+		}
+	}
+	printf("  output: %s\n", failures ? "MISMATCH" : "identical");
+	return failures ? 1 : 0;
+}
+
+static int FileRead(void* buffer, size_t length, void* userdata)
+{
+	FILE* f = (FILE*)userdata;
+	if(fread(buffer, 1, length, f) == length)
+		return 1;
+	return ferror(f) ? -1 : 0;
+}
+
+static int FileSeek(int64_t offset, int whence, void* userdata)
+{
+	FILE* f = (FILE*)userdata;
+	switch(whence)
+	{
+	case NESTEGG_SEEK_SET: return fseek(f, (long)offset, SEEK_SET);
+	case NESTEGG_SEEK_CUR: return fseek(f, (long)offset, SEEK_CUR);
+	case NESTEGG_SEEK_END: return fseek(f, (long)offset, SEEK_END);
+	}
+	return -1;
+}
+
+static int64_t FileTell(void* userdata)
+{
+	return ftell((FILE*)userdata);
+}
+
+//Demux every packet of a file, either freeing each packet or reading into the previous one
+static int DemuxFile(const char* filename, bool reuse, nestegg_stats& stats, double& seconds, unsigned long long& hash)
+{
+	FILE* f = fopen(filename, "rb");
+	if(!f)
+		return -1;
+	nestegg_io io = { FileRead, FileSeek, FileTell, f };
+	nestegg* ne = NULL;
+	if(nestegg_init(&ne, io, NULL, -1) < 0)
+	{
+		fclose(f);
+		return -1;
+	}
+
+	// stats from here on count only the packet reads
+	nestegg_stats start;
+	nestegg_get_stats(ne, &start);
+	const double begin = Seconds();
+	nestegg_packet* packet = NULL;
+	int result;
+	hash = 14695981039346656037ull;
+	for(;;)
+	{
+		if(reuse)
+			result = nestegg_read_packet_into(ne, &packet);
+		else
+		{
+			if(packet)
+				nestegg_free_packet(packet);
+			packet = NULL;
+			result = nestegg_read_packet(ne, &packet);
+		}
+		if(result <= 0)
+			break;
+
+		unsigned int chunks = 0;
+		nestegg_packet_count(packet, &chunks);
+		for(unsigned int i = 0; i < chunks; ++i)
+		{
+			unsigned char* data = NULL;
+			size_t length = 0;
+			nestegg_packet_data(packet, i, &data, &length);
+			for(size_t b = 0; b < length; b += 64)
+				hash = (hash ^ data[b]) * 1099511628211ull;
+			hash = (hash ^ length) * 1099511628211ull;
+		}
+	}
+	seconds = Seconds() - begin;
+	if(packet)
+		nestegg_free_packet(packet);
+	nestegg_get_stats(ne, &stats);
+	stats.packets -= start.packets;
+	stats.allocations -= start.allocations;
+	nestegg_destroy(ne);
+	fclose(f);
+	return result;
+}
+
+static int BenchPackets(int argc, char** argv)
+{
+	int failures = 0;
+	for(int i = 0; i < argc; ++i)
+	{
+		const char* filename = argv[i];
+		printf("%s\n", filename);
+		unsigned long long hashes[2] = {};
+		nestegg_stats stats = {};
+		for(int reuse = 0; reuse < 2; ++reuse)
+		{
+			double seconds = 0.0;
+			if(DemuxFile(filename, reuse != 0, stats, seconds, hashes[reuse]) < 0)
+			{
+				printf("failed to demux %s\n", filename);
+				return 1;
+			}
+			printf("  %-6s %7llu packets %8llu allocations (%5.2f per packet) %8.3f ms\n", reuse ? "reuse" : "free",
+				(unsigned long long)stats.packets, (unsigned long long)stats.allocations,
+				stats.packets ? (double)stats.allocations / stats.packets : 0.0, seconds * 1000.0);
+		}
+		// each request used to be one callback into the Io
+		const double packets = stats.packets ? (double)stats.packets : 1.0;
+		printf("  io: %.2f requests per packet, %.2f callbacks per packet, %.2f saved\n", stats.io_requests / packets,
+			stats.io_calls / packets, ((double)stats.io_requests - (double)stats.io_calls) / packets);
+		printf("  payloads: %s\n", hashes[0] == hashes[1] ? "identical" : "MISMATCH");
+		if(hashes[0] != hashes[1])
+			++failures;
+	}
+	return failures ? 1 : 0;
+}
+
+//nestegg Io over a block of memory, so seek timings aren't dominated by the file system
+struct MemoryStream
+{
+	const unsigned char* data;
+	size_t size;
+	size_t pos;
+};
+
+static int MemoryRead(void* buffer, size_t length, void* userdata)
+{
+	MemoryStream* m = (MemoryStream*)userdata;
+	if(length > m->size - m->pos)
+		return 0;
+	memcpy(buffer, m->data + m->pos, length);
+	m->pos += length;
+	return 1;
+}
+
+static int MemorySeek(int64_t offset, int whence, void* userdata)
+{
+	MemoryStream* m = (MemoryStream*)userdata;
+	int64_t base = 0;
+	if(whence == NESTEGG_SEEK_CUR)
+		base = (int64_t)m->pos;
+	else if(whence == NESTEGG_SEEK_END)
+		base = (int64_t)m->size;
+	if(base + offset < 0 || base + offset > (int64_t)m->size)
+		return -1;
+	m->pos = (size_t)(base + offset);
+	return 0;
+}
+
+static int64_t MemoryTell(void* userdata)
+{
+	return (int64_t)((MemoryStream*)userdata)->pos;
+}
+
+//Minimal EBML writer for synthetic files
+static void PutId(std::vector<unsigned char>& out, unsigned int id)
+{
+	int bytes = id > 0xFFFFFF ? 4 : id > 0xFFFF ? 3 : id > 0xFF ? 2 : 1;
+	while(bytes--)
+		out.push_back((unsigned char)(id >> (bytes * 8)));
+}
+
+//Sizes and positions are always written 8 bytes wide, so they can be patched in place
+static void PutSize(std::vector<unsigned char>& out, unsigned long long size)
+{
+	out.push_back(0x01);
+	for(int i = 6; i >= 0; --i)
+		out.push_back((unsigned char)(size >> (i * 8)));
+}
+
+static void PutUint(std::vector<unsigned char>& out, unsigned int id, unsigned long long value)
+{
+	PutId(out, id);
+	out.push_back(0x88);
+	for(int i = 7; i >= 0; --i)
+		out.push_back((unsigned char)(value >> (i * 8)));
+}
+
+static void PutFloat(std::vector<unsigned char>& out, unsigned int id, double value)
+{
+	unsigned long long bits;
+	memcpy(&bits, &value, sizeof(bits));
+	PutUint(out, id, bits);
+}
+
+static void PutString(std::vector<unsigned char>& out, unsigned int id, const char* value)
+{
+	PutId(out, id);
+	out.push_back((unsigned char)(0x80 | strlen(value)));
+	out.insert(out.end(), value, value + strlen(value));
+}
+
+//Open a master element; returns where its size goes for EndMaster
+static size_t BeginMaster(std::vector<unsigned char>& out, unsigned int id)
+{
+	PutId(out, id);
+	const size_t at = out.size();
+	PutSize(out, 0);
+	return at;
+}
+
+static void EndMaster(std::vector<unsigned char>& out, size_t at)
+{
+	std::vector<unsigned char> size;
+	PutSize(size, out.size() - at - 8);
+	std::copy(size.begin(), size.end(), out.begin() + at);
+}
+
+//A one-track WebM with a one-second cluster per cue, cues at the end like most muxers write them.
+//Live files have no cues and leave the cluster sizes unknown, like a capture that was never finalized.
+static std::vector<unsigned char> SyntheticWebm(unsigned int clusters, bool live = false)
+{
+	std::vector<unsigned char> out;
+	size_t ebml = BeginMaster(out, 0x1A45DFA3);
+	PutUint(out, 0x4286, 1);
+	PutUint(out, 0x42F7, 1);
+	PutUint(out, 0x42F2, 4);
+	PutUint(out, 0x42F3, 8);
+	PutString(out, 0x4282, "webm");
+	PutUint(out, 0x4287, 2);
+	PutUint(out, 0x4285, 2);
+	EndMaster(out, ebml);
+
+	size_t segment = BeginMaster(out, 0x18538067);
+	const size_t segmentdata = out.size();
+	size_t seekhead = BeginMaster(out, 0x114D9B74);
+	size_t seek = BeginMaster(out, 0x4DBB);
+	PutId(out, 0x53AB);
+	out.push_back(0x84);
+	PutId(out, 0x1C53BB6B);
+	PutUint(out, 0x53AC, 0);
+	const size_t cuesposition = out.size() - 8;
+	EndMaster(out, seek);
+	EndMaster(out, seekhead);
+
+	size_t info = BeginMaster(out, 0x1549A966);
+	PutUint(out, 0x2AD7B1, 1000000);
+	PutFloat(out, 0x4489, clusters * 1000.0);
+	EndMaster(out, info);
+
+	size_t tracks = BeginMaster(out, 0x1654AE6B);
+	size_t entry = BeginMaster(out, 0xAE);
+	PutUint(out, 0xD7, 1);
+	PutUint(out, 0x73C5, 1);
+	PutUint(out, 0x83, 1);
+	PutString(out, 0x86, "V_VP8");
+	size_t video = BeginMaster(out, 0xE0);
+	PutUint(out, 0xB0, 64);
+	PutUint(out, 0xBA, 64);
+	EndMaster(out, video);
+	EndMaster(out, entry);
+	EndMaster(out, tracks);
+
+	std::vector<unsigned long long> positions;
+	for(unsigned int i = 0; i < clusters; ++i)
+	{
+		positions.push_back(out.size() - segmentdata);
+		size_t cluster = BeginMaster(out, 0x1F43B675);
+		if(live)
+			std::fill(out.begin() + cluster + 1, out.begin() + cluster + 8, 0xFF);
+		PutUint(out, 0xE7, i * 1000ull);
+		// keyframe SimpleBlock on track 1 with a few bytes of stand-in payload
+		PutId(out, 0xA3);
+		out.push_back(0x88);
+		const unsigned char block[] = { 0x81, 0x00, 0x00, 0x80, (unsigned char)i, (unsigned char)(i >> 8), (unsigned char)(i >> 16), 0x00 };
+		out.insert(out.end(), block, block + sizeof(block));
+		if(!live)
+			EndMaster(out, cluster);
+	}
+	if(live)
+	{
+		EndMaster(out, segment);
+		return out;
+	}
+
+	const unsigned long long cues = out.size() - segmentdata;
+	for(int i = 7; i >= 0; --i)
+		out[cuesposition + 7 - i] = (unsigned char)(cues >> (i * 8));
+	size_t cuesmaster = BeginMaster(out, 0x1C53BB6B);
+	for(unsigned int i = 0; i < clusters; ++i)
+	{
+		size_t point = BeginMaster(out, 0xBB);
+		PutUint(out, 0xB3, i * 1000ull);
+		size_t pos = BeginMaster(out, 0xB7);
+		PutUint(out, 0xF7, 1);
+		PutUint(out, 0xF1, positions[i]);
+		EndMaster(out, pos);
+		EndMaster(out, point);
+	}
+	EndMaster(out, cuesmaster);
+	EndMaster(out, segment);
+	return out;
+}
+
+enum SeekMode
+{
+	SEEK_COLD,			//straight after opening
+	SEEK_AFTER_PLAYING,	//after reading every packet, which indexes the clusters of files without cues
+	SEEK_WITH_INDEX		//after loading the cluster index saved by an earlier pass
+};
+
+//Seek to random times on the first video track. For synthetic files the landing cluster is checked.
+//The first seek goes to the end, which loads the cues or scans every cluster header in a file without them.
+static int SeekStream(const char* name, const std::vector<unsigned char>& data, bool synthetic, int seeks,
+	SeekMode mode = SEEK_COLD, std::vector<unsigned char>* index = NULL)
+{
+	MemoryStream stream = { data.data(), data.size(), 0 };
+	nestegg_io io = { MemoryRead, MemorySeek, MemoryTell, &stream };
+	nestegg* ne = NULL;
+	if(nestegg_init(&ne, io, NULL, -1) < 0)
+	{
+		printf("failed to open %s\n", name);
+		return 1;
+	}
+	uint64_t duration = 0;
+	if(nestegg_duration(ne, &duration) < 0)
+		duration = 0;
+
+	unsigned int tracks = 0, track = 0;
+	nestegg_track_count(ne, &tracks);
+	while(track < tracks && nestegg_track_type(ne, track) != NESTEGG_TRACK_VIDEO)
+		++track;
+
+	int failures = 0;
+	if(mode == SEEK_AFTER_PLAYING)
+	{
+		nestegg_packet* packet = NULL;
+		while(nestegg_read_packet_into(ne, &packet) == 1)
+			;
+	}
+	else if(mode == SEEK_WITH_INDEX && (!index || nestegg_load_cluster_index(ne, index->data(), index->size()) < 0))
+		++failures;
+
+	const uint64_t span = duration ? duration : 1000000000ull;
+	nestegg_stats before, after;
+	nestegg_get_stats(ne, &before);
+	double start = Seconds();
+	if(nestegg_track_seek(ne, track, span - 1) < 0)
+		++failures;
+	const double first = Seconds() - start;
+	nestegg_get_stats(ne, &after);
+
+	srand(1);
+	double total = 0.0, worst = 0.0, late = 0.0;
+	int latecount = 0;
+	for(int i = 0; i < seeks; ++i)
+	{
+		const uint64_t target = (uint64_t)(((double)rand() / RAND_MAX) * (double)(span - 1));
+		start = Seconds();
+		nestegg_packet* packet = NULL;
+		int result = nestegg_track_seek(ne, track, target);
+		if(result == 0)
+			result = nestegg_read_packet(ne, &packet);
+		const double seconds = Seconds() - start;
+		total += seconds;
+		worst = std::max(worst, seconds);
+		if(target > span / 10 * 9)
+		{
+			late += seconds;
+			++latecount;
+		}
+
+		uint64_t tstamp = 0;
+		if(result != 1 || nestegg_packet_tstamp(packet, &tstamp) < 0)
+			++failures;
+		else if(synthetic && tstamp != target / 1000000000ull * 1000000000ull)
+			++failures;
+		if(packet)
+			nestegg_free_packet(packet);
+	}
+
+	if(index && mode != SEEK_WITH_INDEX)
+	{
+		size_t length = 0;
+		nestegg_save_cluster_index(ne, NULL, &length);
+		index->resize(length);
+		if(nestegg_save_cluster_index(ne, index->data(), &length) < 0)
+			++failures;
+	}
+	nestegg_destroy(ne);
+
+	printf("  %-40s %9zu bytes  first seek %8.3f ms (%6llu Io callbacks)  then %7.2f us average, %7.2f us in the last 10%%, worst %7.2f us  %s\n",
+		name, data.size(), first * 1000.0, (unsigned long long)(after.io_calls - before.io_calls),
+		total * 1e6 / seeks, latecount ? late * 1e6 / latecount : 0.0, worst * 1e6, failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
+
+//Load a saved cluster index into a file it wasn't saved for, which nestegg must refuse
+static int StaleIndexAccepted(const std::vector<unsigned char>& data, const std::vector<unsigned char>& index)
+{
+	MemoryStream stream = { data.data(), data.size(), 0 };
+	nestegg_io io = { MemoryRead, MemorySeek, MemoryTell, &stream };
+	nestegg* ne = NULL;
+	if(nestegg_init(&ne, io, NULL, -1) < 0)
+		return 1;
+	const int loaded = nestegg_load_cluster_index(ne, index.data(), index.size());
+	nestegg_destroy(ne);
+	return loaded < 0 ? 0 : 1;
+}
+
+static int BenchSeek(int argc, char** argv)
+{
+	const int seeks = 2000;
+	int failures = 0;
+	printf("%d random seeks per file\n", seeks);
+	for(int i = 0; i < argc; ++i)
+	{
+		FILE* f = fopen(argv[i], "rb");
+		if(!f)
+		{
+			printf("failed to open %s\n", argv[i]);
+			return 1;
+		}
+		std::vector<unsigned char> data;
+		unsigned char buffer[65536];
+		size_t br;
+		while((br = fread(buffer, 1, sizeof(buffer), f)) > 0)
+			data.insert(data.end(), buffer, buffer + br);
+		fclose(f);
+		failures += SeekStream(argv[i], data, false, seeks);
+	}
+
+	const unsigned int sizes[] = { 100, 1000, 10000, 100000 };
+	for(unsigned int clusters : sizes)
+	{
+		char name[64];
+		snprintf(name, sizeof(name), "synthetic, %u cues", clusters);
+		failures += SeekStream(name, SyntheticWebm(clusters), true, seeks);
+	}
+
+	// without cues the clusters are indexed by playing, by scanning their headers on a seek, or from a saved index
+	std::vector<unsigned char> previous;
+	for(unsigned int clusters : sizes)
+	{
+		const std::vector<unsigned char> live = SyntheticWebm(clusters, true);
+		std::vector<unsigned char> index;
+		char name[64];
+		snprintf(name, sizeof(name), "live, %u clusters", clusters);
+		failures += SeekStream(name, live, true, seeks, SEEK_COLD, &index);
+		snprintf(name, sizeof(name), "live, %u clusters, after playing", clusters);
+		failures += SeekStream(name, live, true, seeks, SEEK_AFTER_PLAYING);
+		snprintf(name, sizeof(name), "live, %u clusters, index loaded", clusters);
+		failures += SeekStream(name, live, true, seeks, SEEK_WITH_INDEX, &index);
+
+		// the index of the previous file, and this file's index once the capture has grown, are stale
+		std::vector<unsigned char> grown = live;
+		grown.resize(grown.size() + 4096);
+		const int stale = (previous.empty() ? 0 : StaleIndexAccepted(live, previous)) + StaleIndexAccepted(grown, index);
+		printf("  %-40s %s\n", "stale indexes refused", stale ? "FAILED" : "ok");
+		failures += stale;
+		previous = index;
+	}
+	return failures ? 1 : 0;
+}
+
+//Player Io over a file that counts the calls it gets
+struct CountingFile
+{
+	FILE* f;
+	unsigned long long calls;
+	unsigned long long bytes;
+};
+
+static size_t CountingRead(THEORAPLAYER_Io* io, void* buf, long buflen)
+{
+	CountingFile* file = (CountingFile*)io->userdata;
+	file->calls++;
+	const size_t br = fread(buf, 1, buflen, file->f);
+	file->bytes += br;
+	return br;
+}
+
+static int CountingSeek(THEORAPLAYER_Io* io, long long offset, int whence)
+{
+	CountingFile* file = (CountingFile*)io->userdata;
+	file->calls++;
+	return fseek(file->f, (long)offset, whence);
+}
+
+static long long CountingTell(THEORAPLAYER_Io* io)
+{
+	return ftell(((CountingFile*)io->userdata)->f);
+}
+
+static void CountingClose(THEORAPLAYER_Io* io)
+{
+	fclose(((CountingFile*)io->userdata)->f);
+}
+
+//SeekToMs latency and Io through the file's cues (or its clusters when it has none) against a seek index,
+//checking every landing frame against a straight decode
+static int BenchSeekIndex(int argc, char** argv)
+{
+	const char* filename = argv[0];
+	const int seeks = argc > 1 ? atoi(argv[1]) : 50;
+
+	std::vector<unsigned int> times;
+	std::vector<unsigned long long> hashes;
+	double linear = 0.0;
+	{
+		WebmPlayer player;
+		if(player.OpenDecode(filename, THEORAPLAYER_VIDFMT_IYUV) < 0 || player.Prepare() < 0)
+		{
+			printf("failed to decode %s\n", filename);
+			return 1;
+		}
+		THEORAPLAYER_VideoFrame frame = {};
+		const double start = Seconds();
+		while(player.GetVideoFrame(&frame) > 0)
+		{
+			unsigned long long hash = 14695981039346656037ull;
+			HashFrame(frame, hash);
+			times.push_back(frame.playms);
+			hashes.push_back(hash);
+		}
+		linear = Seconds() - start;
+		player.FreeFrameData(&frame);
+	}
+	if(times.empty())
+		return 1;
+	const unsigned int duration = times.back();
+	printf("%s: %u ms, %d frames, full decode %.1f ms\n", filename, duration, (int)times.size(), linear * 1000.0);
+
+	const std::string indexname = std::string(filename) + ".seekidx";
+	const double buildstart = Seconds();
+	if(WEBMPLAYER_BuildSeekIndex(filename, indexname.c_str()) < 0)
+	{
+		printf("failed to build %s\n", indexname.c_str());
+		return 1;
+	}
+	const double build = Seconds() - buildstart;
+
+	int failures = 0;
+	for(int indexed = 0; indexed <= 1; indexed++)
+	{
+		CountingFile file = { fopen(filename, "rb"), 0, 0 };
+		if(!file.f)
+			return 1;
+		THEORAPLAYER_Io io = {};
+		io.read = CountingRead;
+		io.close = CountingClose;
+		io.userdata = &file;
+		io.seek = CountingSeek;
+		io.tell = CountingTell;
+
+		WebmPlayer player;
+		if(player.OpenDecode(&io, THEORAPLAYER_VIDFMT_IYUV) < 0 || player.Prepare() < 0)
+			return 1;
+		if(indexed && player.LoadSeekIndex(indexname.c_str()) < 0)
+		{
+			printf("failed to load %s\n", indexname.c_str());
+			return 1;
+		}
+
+		THEORAPLAYER_VideoFrame frame = {};
+		file.calls = 0;
+		file.bytes = 0;
+		unsigned int seed = 12345;
+		int mismatches = 0;
+		double total = 0.0, worst = 0.0;
+		for(int i = 0; i < seeks; i++)
+		{
+			seed = seed * 1103515245 + 12345;
+			const unsigned int target = (seed >> 8) % (duration + 1);
+
+			const double start = Seconds();
+			int result = player.SeekToMs(target);
+			if(result > 0)
+				result = player.GetVideoFrame(&frame);
+			const double elapsed = Seconds() - start;
+			total += elapsed;
+			worst = std::max(worst, elapsed);
+
+			const size_t expect = std::lower_bound(times.begin(), times.end(), target) - times.begin();
+			unsigned long long hash = 14695981039346656037ull;
+			if(result > 0)
+				HashFrame(frame, hash);
+			if(result <= 0 || frame.playms != times[expect] || hash != hashes[expect])
+			{
+				printf("  MISMATCH seeking to %u ms: got %u ms, expected %u ms\n", target, result > 0 ? frame.playms : 0, times[expect]);
+				mismatches++;
+			}
+		}
+		player.FreeFrameData(&frame);
+
+		if(indexed)
+		{
+			FILE* f = fopen(indexname.c_str(), "rb");
+			long bytes = 0;
+			if(f && fseek(f, 0, SEEK_END) == 0)
+				bytes = ftell(f);
+			if(f)
+				fclose(f);
+			printf("  with index (%ld bytes, built in %.1f ms):\n", bytes, build * 1000.0);
+		}
+		else
+			printf("  through cues or clusters:\n");
+		printf("    %d seeks: average %.2f ms, worst %.2f ms\n", seeks, total * 1000.0 / seeks, worst * 1000.0);
+		printf("    %.1f Io calls and %.0f KB per seek\n", (double)file.calls / seeks, (double)file.bytes / seeks / 1024.0);
+		printf("    landing frames: %s\n", mismatches ? "MISMATCH" : "identical");
+		failures += mismatches;
+	}
+	remove(indexname.c_str());
+	return failures ? 1 : 0;
+}
+
+//Cost of a skipped frame against a converted one, showing every nth frame and checking each shown frame
+//against a straight decode of the file
+static int BenchSkip(int argc, char** argv)
+{
+	const char* filename = argv[0];
+	const int every = argc > 1 ? std::max(atoi(argv[1]), 1) : 4;
+
+	int failures = 0;
+	printf("%s, showing every %d frames\n", filename, every);
+	for(auto format : { THEORAPLAYER_VIDFMT_IYUV, THEORAPLAYER_VIDFMT_BGRA })
+	{
+		std::vector<unsigned long long> hashes;
+		double decoded = 0.0, shown = 0.0, skipped = 0.0;
+		int showncount = 0, skippedcount = 0, mismatches = 0;
+		// pass 0 decodes everything for the reference, pass 1 skips all but every nth frame
+		for(int pass = 0; pass < 2; pass++)
+		{
+			WebmPlayer player;
+			if(player.OpenDecode(filename, format) < 0 || player.Prepare() < 0)
+			{
+				printf("failed to open %s\n", filename);
+				return 1;
+			}
+			THEORAPLAYER_VideoFrame frame = {};
+			size_t index = 0;
+			for(;;)
+			{
+				const bool show = pass == 0 || index % every == 0;
+				const double start = Seconds();
+				const int result = show ? player.GetVideoFrame(&frame) : player.SkipVideoFrame();
+				const double seconds = Seconds() - start;
+				if(result < 0)
+				{
+					printf("failed to decode %s\n", filename);
+					return 1;
+				}
+				if(result == 0)
+					break;
+
+				unsigned long long hash = 14695981039346656037ull;
+				if(show)
+					HashFrame(frame, hash);
+				if(pass == 0)
+				{
+					decoded += seconds;
+					hashes.push_back(hash);
+				}
+				else if(show)
+				{
+					shown += seconds;
+					showncount++;
+					mismatches += index >= hashes.size() || hash != hashes[index];
+				}
+				else
+				{
+					skipped += seconds;
+					skippedcount++;
+				}
+				index++;
+			}
+			player.FreeFrameData(&frame);
+		}
+
+		failures += mismatches;
+		printf("  %-4s decoded %7.3f ms/frame  shown %7.3f ms/frame  skipped %7.3f ms/frame  (%d shown, %d skipped)  %s\n",
+			format == THEORAPLAYER_VIDFMT_IYUV ? "IYUV" : "BGRA", decoded * 1000.0 / std::max(hashes.size(), (size_t)1),
+			shown * 1000.0 / std::max(showncount, 1), skipped * 1000.0 / std::max(skippedcount, 1), showncount, skippedcount,
+			mismatches ? "MISMATCH" : "identical");
+	}
+	return failures ? 1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+	if(argc >= 3 && !strcmp(argv[1], "threads"))
+		return BenchThreads(argc - 2, argv + 2);
+	if(argc >= 3 && !strcmp(argv[1], "packets"))
+		return BenchPackets(argc - 2, argv + 2);
+	if(argc >= 2 && !strcmp(argv[1], "seek"))
+		return BenchSeek(argc - 2, argv + 2);
+	if(argc >= 3 && !strcmp(argv[1], "seekindex"))
+		return BenchSeekIndex(argc - 2, argv + 2);
+	if(argc >= 3 && !strcmp(argv[1], "skip"))
+		return BenchSkip(argc - 2, argv + 2);
+
+	printf("usage: %s threads file.webm [maxthreads iterations]\n", argv[0]);
+	printf("       %s packets file.webm [more.webm ...]\n", argv[0]);
+	printf("       %s seek [file.webm ...]\n", argv[0]);
+	printf("       %s seekindex file.webm [seeks]\n", argv[0]);
+	printf("       %s skip file.webm [every]\n", argv[0]);
+	return 1;
+}
@@ -0,0 +1,1059 @@
+// Copyright (c) Promit Roy.
+// All rights reserved.
+//
+// This code is licensed under the MIT License.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "WebmPlayer.h"
+#include "ColorConvert.h"
+#include "SeekIndex.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <climits>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <vector>
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+//Most threads the automatic count will pick; past this libvpx has run out of rows and tiles to share at common sizes
+#define WEBMPLAYER_MAX_AUTO_THREADS 8
+
+extern "C" {
+#include "vpx_decoder.h"
+#include "vp8dx.h"
+#include "nestegg/nestegg.h"
+}
+
+typedef THEORAPLAYER_VideoFrame VideoFrame;
+
+static void* DefaultAlloc(THEORAPLAYER_Allocator*, size_t size, size_t alignment)
+{
+#if defined(_WIN32)
+	return _aligned_malloc(size, alignment);
+#else
+	void* ptr = NULL;
+	return (posix_memalign(&ptr, alignment, size) == 0) ? ptr : NULL;
+#endif
+}
+
+static void DefaultFree(THEORAPLAYER_Allocator*, void* ptr)
+{
+#if defined(_WIN32)
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
+
+//Pooled frame buffer. refs counts libvpx's hold on it plus every acquired frame using it.
+struct WEBMPLAYER_FrameBuffer
+{
+	unsigned char* data;
+	size_t size;
+	int refs;
+};
+
+struct WEBMPLAYER_Decoder
+{
+	THEORAPLAYER_Io *io;
+	THEORAPLAYER_VideoFormat vidfmt;
+	THEORAPLAYER_ConvertRowFn rowfn;  // NULL for the planar formats
+
+	THEORAPLAYER_Allocator allocator = { DefaultAlloc, DefaultFree, NULL };
+	THEORAPLAYER_Allocator* userallocator = NULL;  // passed back to the user's callbacks
+
+	unsigned int threads = 0;  // 0 picks automatically in Prepare
+	WEBMPLAYER_ThreadMode threadmode = WEBMPLAYER_THREADS_ROWS;
+
+	// keyframe index from LoadSeekIndex, in the user's memory or seekindexdata
+	const THEORAPLAYER_SeekIndexEntry* seekindex = NULL;
+	size_t seekindexcount = 0;
+	unsigned char* seekindexdata = NULL;
+
+	// Total size of the file behind the Io, or -1 if it can't tell. Leaves the read position where it was.
+	long long IoSize()
+	{
+		if(io->size)
+			return io->size(io);
+		if(!io->seek || !io->tell)
+			return -1;
+		const long long position = io->tell(io);
+		if(position < 0 || io->seek(io, 0, SEEK_END) != 0)
+			return -1;
+		const long long size = io->tell(io);
+		if(io->seek(io, position, SEEK_SET) != 0)
+			return -1;
+		return size;
+	}
+
+	void* Alloc(size_t size)
+	{
+		THEORAPLAYER_Allocator* a = userallocator ? userallocator : &allocator;
+		return a->alloc(a, size, THEORAPLAYER_FRAME_ALIGNMENT);
+	}
+
+	void Free(void* ptr)
+	{
+		if(!ptr)
+			return;
+		THEORAPLAYER_Allocator* a = userallocator ? userallocator : &allocator;
+		a->free(a, ptr);
+	}
+
+	std::vector<WEBMPLAYER_FrameBuffer*> buffers;  // every pooled buffer, in use or not
+	std::mutex bufferlock;  // libvpx's frame threads and ReleaseFrame callers can get here at once
+
+	//Take an unused buffer of at least size bytes, holding one reference to it
+	WEBMPLAYER_FrameBuffer* GetBuffer(size_t size)
+	{
+		std::lock_guard<std::mutex> guard(bufferlock);
+		WEBMPLAYER_FrameBuffer* fb = NULL;
+		for(auto buffer : buffers)
+		{
+			if(buffer->refs)
+				continue;
+			fb = buffer;
+			if(buffer->size >= size)
+				break;
+		}
+		if(fb && fb->size < size)
+		{
+			// the stream got bigger; grow the unused buffer rather than adding another
+			Free(fb->data);
+			fb->data = NULL;
+			fb->size = 0;
+		}
+		if(!fb)
+		{
+			fb = new WEBMPLAYER_FrameBuffer();
+			buffers.push_back(fb);
+		}
+		if(!fb->data)
+		{
+			fb->data = (unsigned char*)Alloc(size);
+			if(!fb->data)
+				return NULL;
+			// libvpx requires new buffers to be zeroed
+			memset(fb->data, 0, size);
+			fb->size = size;
+		}
+		fb->refs = 1;
+		return fb;
+	}
+
+	void AddRef(WEBMPLAYER_FrameBuffer* fb)
+	{
+		std::lock_guard<std::mutex> guard(bufferlock);
+		fb->refs++;
+	}
+
+	void ReleaseBuffer(WEBMPLAYER_FrameBuffer* fb)
+	{
+		std::lock_guard<std::mutex> guard(bufferlock);
+		fb->refs--;
+	}
+
+	~WEBMPLAYER_Decoder()
+	{
+		for(auto buffer : buffers)
+		{
+			Free(buffer->data);
+			delete buffer;
+		}
+		delete[] seekindexdata;
+		io->close(io);
+	}
+};
+
+// Size of the pixel data for one frame in the given format
+static size_t FrameDataSize(unsigned int width, unsigned int height, THEORAPLAYER_VideoFormat format)
+{
+	const int bpp = THEORAPLAYER_BytesPerPixel(format);
+	if(bpp)
+		return (size_t)width * height * bpp;
+	// planar 4:2:0
+	return (size_t)width * height + 2 * (size_t)(width / 2) * (height / 2);
+}
+
+// nestegg wants all of the bytes or nothing: 1 on success, 0 at the end of the stream, -1 on error
+static int NestEggRead(void *buffer, size_t length, void *userdata)
+{
+	THEORAPLAYER_Io *io = (THEORAPLAYER_Io *)userdata;
+	unsigned char *dst = (unsigned char *)buffer;
+	while(length > 0)
+	{
+		const long chunk = (length > LONG_MAX) ? LONG_MAX : (long)length;
+		const size_t br = io->read(io, dst, chunk);
+		if(br == (size_t)-1)
+			return -1;
+		if(br == 0)
+			return 0;
+		dst += br;
+		length -= br;
+	}
+	return 1;
+} // NestEggRead
+
+static int NestEggSeek(int64_t offset, int whence, void *userdata)
+{
+	THEORAPLAYER_Io *io = (THEORAPLAYER_Io *)userdata;
+	if(!io->seek)
+		return -1;
+	switch(whence)
+	{
+	case NESTEGG_SEEK_SET:
+		return io->seek(io, offset, SEEK_SET);
+	case NESTEGG_SEEK_CUR:
+		return io->seek(io, offset, SEEK_CUR);
+	case NESTEGG_SEEK_END:
+		return io->seek(io, offset, SEEK_END);
+	}
+	return -1;
+} // NestEggSeek
+
+static int64_t NestEggTell(void *userdata)
+{
+	THEORAPLAYER_Io *io = (THEORAPLAYER_Io *)userdata;
+	if(!io->tell)
+		return -1;
+	return io->tell(io);
+} // NestEggTell
+
+// libvpx's external frame buffer callbacks, which hand out the decoder's pool
+static int GetFrameBuffer(void* priv, size_t size, vpx_codec_frame_buffer_t* fb)
+{
+	WEBMPLAYER_Decoder* ctx = (WEBMPLAYER_Decoder*)priv;
+	WEBMPLAYER_FrameBuffer* buffer = ctx->GetBuffer(size);
+	if(!buffer)
+		return -1;
+	fb->data = buffer->data;
+	fb->size = buffer->size;
+	fb->priv = buffer;
+	return 0;
+}
+
+static int ReleaseFrameBuffer(void* priv, vpx_codec_frame_buffer_t* fb)
+{
+	WEBMPLAYER_Decoder* ctx = (WEBMPLAYER_Decoder*)priv;
+	if(fb->priv)
+		ctx->ReleaseBuffer((WEBMPLAYER_FrameBuffer*)fb->priv);
+	return 0;
+}
+
+// Open nestegg over an Io
+static int OpenNestEgg(nestegg** ne, THEORAPLAYER_Io* io)
+{
+	nestegg_io neio;
+	neio.read = NestEggRead;
+	neio.seek = NestEggSeek;
+	neio.tell = NestEggTell;
+	neio.userdata = io;
+	if(nestegg_init(ne, neio, NULL, -1) < 0)
+	{
+		*ne = NULL;
+		return -1;
+	}
+	return 1;
+}
+
+// The first VP8 or VP9 video track and its decoder
+static int FindVideoTrack(nestegg* ne, unsigned int* track, vpx_codec_iface_t** iface)
+{
+	unsigned int tracks = 0;
+	if(nestegg_track_count(ne, &tracks) < 0)
+		return -1;
+
+	for(unsigned int i = 0; i < tracks; ++i)
+	{
+		if(nestegg_track_type(ne, i) != NESTEGG_TRACK_VIDEO)
+			continue;
+		const int codecid = nestegg_track_codec_id(ne, i);
+		if(codecid == NESTEGG_CODEC_VP8)
+			*iface = &vpx_codec_vp8_dx_algo;
+		else if(codecid == NESTEGG_CODEC_VP9)
+			*iface = &vpx_codec_vp9_dx_algo;
+		else
+			continue;
+		*track = i;
+		return 1;
+	}
+	return -1;
+}
+
+// True if a chunk of video data is a keyframe, which needs no earlier frames to decode
+static int IsKeyframe(vpx_codec_iface_t* iface, const unsigned char* data, size_t length)
+{
+	vpx_codec_stream_info_t si;
+	memset(&si, 0, sizeof(si));
+	si.sz = sizeof(si);
+	if(vpx_codec_peek_stream_info(iface, data, (unsigned int)length, &si) != VPX_CODEC_OK)
+		return 0;
+	return si.is_kf != 0;
+}
+
+struct WEBMPLAYER_State
+{
+	~WEBMPLAYER_State()
+	{
+		if(packet) nestegg_free_packet(packet);
+		if(codec_init) vpx_codec_destroy(&codec);
+		if(ne) nestegg_destroy(ne);
+	}
+
+	WEBMPLAYER_Decoder* ctx;
+	nestegg* ne = NULL;
+	unsigned int track = 0;
+	double fps = 0.0;
+	int eos = 0;
+
+	vpx_codec_iface_t* iface = NULL;
+	vpx_codec_ctx_t codec;
+	int codec_init = 0;
+	int external = 0;  // decoding into the decoder's buffer pool
+	int flushed = 0;  // the decoder has been told there is no more data
+	vpx_codec_iter_t iter = NULL;
+
+	nestegg_packet* packet = NULL;  // video packet being decoded
+	unsigned int chunk = 0;  // next data chunk in the packet
+	unsigned int chunks = 0;
+
+	vpx_image_t* held = NULL;  // picture a seek decoded up to, handed out by the next NextImage
+
+	int Prepare()
+	{
+		if(OpenNestEgg(&ne, ctx->io) < 0)
+			return -1;
+		if(FindVideoTrack(ne, &track, &iface) < 0)
+			return -1;
+
+		uint64_t duration = 0;
+		if(nestegg_track_default_duration(ne, track, &duration) == 0 && duration > 0)
+			fps = 1e9 / (double)duration;
+
+		nestegg_video_params params;
+		if(nestegg_track_video_params(ne, track, &params) < 0)
+			memset(&params, 0, sizeof(params));
+
+		vpx_codec_dec_cfg_t cfg;
+		memset(&cfg, 0, sizeof(cfg));
+		cfg.w = params.width;
+		cfg.h = params.height;
+		cfg.threads = ctx->threads ? ctx->threads : AutoThreads(params.width, params.height);
+		vpx_codec_flags_t flags = 0;
+		if(ctx->threadmode == WEBMPLAYER_THREADS_FRAMES && iface == &vpx_codec_vp9_dx_algo && cfg.threads > 1)
+			flags |= VPX_CODEC_USE_FRAME_THREADING;
+		if(vpx_codec_dec_init(&codec, iface, &cfg, flags) != VPX_CODEC_OK)
+			return -1;
+		codec_init = 1;
+
+		if(vpx_codec_get_caps(iface) & VPX_CODEC_CAP_EXTERNAL_FRAME_BUFFER)
+		{
+			if(vpx_codec_set_frame_buffer_functions(&codec, GetFrameBuffer, ReleaseFrameBuffer, ctx) != VPX_CODEC_OK)
+				return -1;
+			external = 1;
+		}
+		return 1;
+	} //Prepare
+
+	//Thread count for when the user didn't choose one
+	static unsigned int AutoThreads(unsigned int width, unsigned int height)
+	{
+		unsigned int threads = std::thread::hardware_concurrency();
+		threads = std::min(std::max(threads, 1u), (unsigned int)WEBMPLAYER_MAX_AUTO_THREADS);
+		// below roughly 480p the per-thread sync costs as much as the work it shares
+		const unsigned int pixels = width * height;
+		if(pixels && pixels < 320 * 240)
+			threads = 1;
+		else if(pixels && pixels < 640 * 480)
+			threads = std::min(threads, 2u);
+		return threads;
+	}
+
+	//Fill in the frame metadata and make sure it has room for the pixels
+	int AllocateFrame(VideoFrame* frame, unsigned int width, unsigned int height)
+	{
+		// the stream is allowed to change resolution
+		if(frame->pixels && (frame->width != width || frame->height != height || frame->format != ctx->vidfmt))
+		{
+			ctx->Free(frame->pixels);
+			frame->pixels = NULL;
+		}
+		frame->fps = fps;
+		frame->width = width;
+		frame->height = height;
+		frame->format = ctx->vidfmt;
+		if(!frame->pixels)
+			frame->pixels = (unsigned char*)ctx->Alloc(FrameDataSize(width, height, frame->format));
+		if(frame->pixels == NULL)
+			return -1;
+		return 1;
+	}
+
+	//Copy or convert a decoded image into the frame's pixels
+	void ConvertImage(const vpx_image_t* img, unsigned char* pixels)
+	{
+		const int w = img->d_w;
+		const int h = img->d_h;
+		const unsigned char* y = img->planes[VPX_PLANE_Y];
+		const unsigned char* u = img->planes[VPX_PLANE_U];
+		const unsigned char* v = img->planes[VPX_PLANE_V];
+		if(ctx->rowfn)
+		{
+			const int bpp = THEORAPLAYER_BytesPerPixel(ctx->vidfmt);
+			THEORAPLAYER_Convert420(ctx->rowfn, y, img->stride[VPX_PLANE_Y], u, img->stride[VPX_PLANE_U], v, img->stride[VPX_PLANE_V],
+				w, h, pixels, w * bpp);
+			return;
+		}
+
+		// planar, laid out the same way as TheoraPlayer's
+		const unsigned char* p1 = (ctx->vidfmt == THEORAPLAYER_VIDFMT_YV12) ? v : u;
+		const unsigned char* p2 = (ctx->vidfmt == THEORAPLAYER_VIDFMT_YV12) ? u : v;
+		const int s1 = (ctx->vidfmt == THEORAPLAYER_VIDFMT_YV12) ? img->stride[VPX_PLANE_V] : img->stride[VPX_PLANE_U];
+		const int s2 = (ctx->vidfmt == THEORAPLAYER_VIDFMT_YV12) ? img->stride[VPX_PLANE_U] : img->stride[VPX_PLANE_V];
+		unsigned char* dst = pixels;
+		for(int i = 0; i < h; i++, dst += w)
+			memcpy(dst, y + img->stride[VPX_PLANE_Y] * i, w);
+		for(int i = 0; i < h / 2; i++, dst += w / 2)
+			memcpy(dst, p1 + s1 * i, w / 2);
+		for(int i = 0; i < h / 2; i++, dst += w / 2)
+			memcpy(dst, p2 + s2 * i, w / 2);
+	}
+
+	//Hand the decoder the next chunk of video data. Returns 0 once the stream is exhausted.
+	int FeedDecoder()
+	{
+		while(!packet || chunk >= chunks)
+		{
+			// reuses the previous packet's memory, so steady playback doesn't allocate
+			const int r = nestegg_read_packet_into(ne, &packet);
+			if(r < 0)
+				return -1;
+			if(r == 0)
+			{
+				if(flushed)
+					return 0;
+				// drain whatever the decoder is still holding on to
+				flushed = 1;
+				iter = NULL;
+				return (vpx_codec_decode(&codec, NULL, 0, NULL, 0) == VPX_CODEC_OK) ? 1 : -1;
+			}
+			if(!packet)
+				continue;
+
+			unsigned int packettrack = 0;
+			if(nestegg_packet_track(packet, &packettrack) < 0)
+				return -1;
+			if(packettrack != track)
+			{
+				// audio isn't handled here
+				chunks = 0;
+				continue;
+			}
+			chunk = 0;
+			if(nestegg_packet_count(packet, &chunks) < 0)
+				return -1;
+		}
+
+		uint64_t tstamp = 0;
+		nestegg_packet_tstamp(packet, &tstamp);
+		unsigned char* data = NULL;
+		size_t length = 0;
+		if(nestegg_packet_data(packet, chunk++, &data, &length) < 0)
+			return -1;
+
+		// the timestamp rides along with the data so it comes out with the right frame
+		void* playms = (void*)(uintptr_t)(tstamp / 1000000);
+		iter = NULL;
+		if(vpx_codec_decode(&codec, data, (unsigned int)length, playms, 0) != VPX_CODEC_OK)
+			return -1;
+		return 1;
+	}
+
+	//Run the decoder until it has a picture. Returns 1 and the image, 0 at the end of the stream, -1 on error.
+	int NextImage(vpx_image_t** img)
+	{
+		if(held)
+		{
+			*img = held;
+			held = NULL;
+			return 1;
+		}
+		if(eos)
+		{
+			return 0;
+		}
+
+		for(;;)
+		{
+			*img = vpx_codec_get_frame(&codec, &iter);
+			if(*img)
+			{
+				if((*img)->fmt != VPX_IMG_FMT_I420 && (*img)->fmt != VPX_IMG_FMT_YV12)
+					return -1;  // !!! FIXME: 4:2:2, 4:4:4 and high bit depth profiles
+				return 1;
+			}
+
+			const int rc = FeedDecoder();
+			if(rc == 0)
+			{
+				eos = 1;  // end of stream
+				return 0;
+			}
+			if(rc < 0)
+				return -1;
+		}
+	}
+
+	//Read up to the first keyframe of the video track and make it the current packet.
+	//Returns 1 and its timestamp, 0 if there is none before the end of the stream.
+	int FindKeyframe(uint64_t* tstamp)
+	{
+		for(;;)
+		{
+			const int r = nestegg_read_packet_into(ne, &packet);
+			if(r <= 0)
+				return r;
+			if(!packet)
+				continue;
+
+			unsigned int packettrack = 0;
+			if(nestegg_packet_track(packet, &packettrack) < 0)
+				return -1;
+			chunk = 0;
+			chunks = 0;
+			if(packettrack != track)
+				continue;
+			if(nestegg_packet_count(packet, &chunks) < 0)
+				return -1;
+
+			unsigned char* data = NULL;
+			size_t length = 0;
+			if(chunks && nestegg_packet_data(packet, 0, &data, &length) == 0 && IsKeyframe(iface, data, length))
+			{
+				nestegg_packet_tstamp(packet, tstamp);
+				return 1;
+			}
+			chunks = 0;
+		}
+	}
+
+	//Reposition so the next decoded frame is the first one with a timestamp at or after ms.
+	//Returns 0 if that is past the end of the video.
+	int Seek(unsigned int ms)
+	{
+		if(!ctx->io->seek || !ctx->io->tell)
+			return -1;
+
+		// pictures still inside the decoder belong to the old position
+		if(!flushed && vpx_codec_decode(&codec, NULL, 0, NULL, 0) != VPX_CODEC_OK)
+			return -1;
+		iter = NULL;
+		while(vpx_codec_get_frame(&codec, &iter))
+			;
+		iter = NULL;
+		held = NULL;
+		flushed = 0;
+		eos = 0;
+
+		// Cues and the index point at clusters that start with a keyframe at or before the target. Without
+		// either, the last cluster before the target may hold no keyframe, so back off until one turns up.
+		const uint64_t target = (uint64_t)ms * 1000000;
+		uint64_t position = target;
+		uint64_t backoff = 1000000000;
+		int rc;
+		for(;;)
+		{
+			int r;
+			if(ctx->seekindexcount)
+				r = nestegg_offset_seek(ne, THEORAPLAYER_FindSeekIndexEntry(ctx->seekindex, ctx->seekindexcount, (long long)target)->offset);
+			else
+				r = nestegg_track_seek(ne, track, position);
+			if(r < 0)
+				return -1;
+
+			uint64_t keyframe = 0;
+			rc = FindKeyframe(&keyframe);
+			if(rc < 0)
+				return -1;
+			if((rc > 0 && keyframe <= target) || ctx->seekindexcount || position == 0)
+				break;
+			position = (position > backoff) ? position - backoff : 0;
+			backoff *= 2;
+		}
+		if(rc == 0)
+		{
+			eos = 1;
+			return 0;
+		}
+
+		// decode forward without output up to the target, keeping the picture that reaches it
+		for(;;)
+		{
+			vpx_image_t* img = NULL;
+			rc = NextImage(&img);
+			if(rc <= 0)
+				return rc;
+			if((unsigned int)(uintptr_t)img->user_priv >= ms)
+			{
+				held = img;
+				return 1;
+			}
+		}
+	}
+
+	int DecodeNextVideoFrame(VideoFrame* frame)
+	{
+		vpx_image_t* img = NULL;
+		const int rc = NextImage(&img);
+		if(rc <= 0)
+			return rc;
+		if(AllocateFrame(frame, img->d_w, img->d_h) < 0)
+			return -1;
+		ConvertImage(img, frame->pixels);
+		frame->playms = (unsigned int)(uintptr_t)img->user_priv;
+		return 1;
+	}
+
+	//libvpx has to decode every frame for the ones after it, so a skip only saves the conversion
+	int SkipVideoFrame()
+	{
+		vpx_image_t* img = NULL;
+		return NextImage(&img);
+	}
+
+	//Timestamp, size and views into libvpx's picture, good until the next vpx_codec_decode
+	void PlaneViews(const vpx_image_t* img, THEORAPLAYER_PlanarFrame* frame) const
+	{
+		frame->playms = (unsigned int)(uintptr_t)img->user_priv;
+		frame->fps = fps;
+		frame->width = img->d_w;
+		frame->height = img->d_h;
+		frame->planes[0] = img->planes[VPX_PLANE_Y];
+		frame->planes[1] = img->planes[VPX_PLANE_U];
+		frame->planes[2] = img->planes[VPX_PLANE_V];
+		frame->strides[0] = img->stride[VPX_PLANE_Y];
+		frame->strides[1] = img->stride[VPX_PLANE_U];
+		frame->strides[2] = img->stride[VPX_PLANE_V];
+	}
+
+	int GetPlanarFrame(THEORAPLAYER_PlanarFrame* frame)
+	{
+		vpx_image_t* img = NULL;
+		const int rc = NextImage(&img);
+		if(rc <= 0)
+			return rc;
+		PlaneViews(img, frame);
+		return 1;
+	}
+
+	int AcquireFrame(WEBMPLAYER_PlanarFrame* frame)
+	{
+		vpx_image_t* img = NULL;
+		const int rc = NextImage(&img);
+		if(rc <= 0)
+			return rc;
+
+		THEORAPLAYER_PlanarFrame& planar = frame->planar;
+		PlaneViews(img, &planar);
+		const int w = img->d_w;
+		const int h = img->d_h;
+		WEBMPLAYER_FrameBuffer* fb = NULL;
+		if(external)
+		{
+			// the image already lives in one of our buffers; keep it out of the pool until the frame is released
+			fb = (WEBMPLAYER_FrameBuffer*)img->fb_priv;
+			ctx->AddRef(fb);
+		}
+		else
+		{
+			const int cw = (w + 1) / 2;
+			const int ch = (h + 1) / 2;
+			fb = ctx->GetBuffer((size_t)w * h + 2 * (size_t)cw * ch);
+			if(!fb)
+				return -1;
+			unsigned char* dst = fb->data;
+			for(int p = 0; p < 3; p++)
+			{
+				const int pw = p ? cw : w;
+				const int ph = p ? ch : h;
+				const unsigned char* src = planar.planes[p];
+				planar.planes[p] = dst;
+				for(int i = 0; i < ph; i++, dst += pw)
+					memcpy(dst, src + planar.strides[p] * i, pw);
+				planar.strides[p] = pw;
+			}
+		}
+
+		frame->buffer = fb->data;
+		frame->buffersize = fb->size;
+		frame->fb = fb;
+		return 1;
+	}
+};
+
+static size_t IoFopenRead(THEORAPLAYER_Io *io, void *buf, long buflen)
+{
+	FILE *f = (FILE *)io->userdata;
+	const size_t br = fread(buf, 1, buflen, f);
+	if((br == 0) && ferror(f))
+		return -1;
+	return br;
+} // IoFopenRead
+
+static int IoFopenSeek(THEORAPLAYER_Io *io, long long offset, int whence)
+{
+	FILE *f = (FILE *)io->userdata;
+#if defined(_WIN32)
+	return _fseeki64(f, offset, whence);
+#else
+	return fseeko(f, (off_t)offset, whence);
+#endif
+} // IoFopenSeek
+
+static long long IoFopenTell(THEORAPLAYER_Io *io)
+{
+	FILE *f = (FILE *)io->userdata;
+#if defined(_WIN32)
+	return _ftelli64(f);
+#else
+	return (long long)ftello(f);
+#endif
+} // IoFopenTell
+
+static void IoFopenClose(THEORAPLAYER_Io *io)
+{
+	FILE *f = (FILE *)io->userdata;
+	fclose(f);
+	//the io struct itself belongs to the WebmPlayer, which deletes it
+} // IoFopenClose
+
+int WEBMPLAYER_BuildSeekIndex(const char *filename, const char *indexFilename)
+{
+	FILE *f = fopen(filename, "rb");
+	if(f == NULL)
+		return -1;
+
+	THEORAPLAYER_Io io = {};
+	io.read = IoFopenRead;
+	io.close = IoFopenClose;
+	io.userdata = f;
+	io.seek = IoFopenSeek;
+	io.tell = IoFopenTell;
+
+	nestegg *ne = NULL;
+	unsigned int track = 0;
+	vpx_codec_iface_t *iface = NULL;
+	if(OpenNestEgg(&ne, &io) < 0 || FindVideoTrack(ne, &track, &iface) < 0)
+	{
+		if(ne)
+			nestegg_destroy(ne);
+		io.close(&io);
+		return -1;
+	}
+
+	// the first keyframe of each cluster; a seek to a later one in the same cluster starts there anyway
+	std::vector<THEORAPLAYER_SeekIndexEntry> entries;
+	nestegg_packet *packet = NULL;
+	int r;
+	while((r = nestegg_read_packet_into(ne, &packet)) > 0)
+	{
+		unsigned int packettrack = 0;
+		unsigned char *data = NULL;
+		size_t length = 0;
+		if(!packet || nestegg_packet_track(packet, &packettrack) < 0 || packettrack != track)
+			continue;
+		if(nestegg_packet_data(packet, 0, &data, &length) < 0 || !IsKeyframe(iface, data, length))
+			continue;
+
+		uint64_t tstamp = 0;
+		int64_t offset = 0;
+		if(nestegg_packet_tstamp(packet, &tstamp) < 0 || nestegg_last_cluster_offset(ne, &offset) < 0)
+		{
+			r = -1;
+			break;
+		}
+		if(!entries.empty() && entries.back().offset == offset)
+			continue;
+		THEORAPLAYER_SeekIndexEntry entry;
+		entry.time = (long long)tstamp;
+		entry.offset = offset;
+		entries.push_back(entry);
+	}
+	if(packet)
+		nestegg_free_packet(packet);
+	nestegg_destroy(ne);
+
+	long long filesize = -1;
+	if(IoFopenSeek(&io, 0, SEEK_END) == 0)
+		filesize = IoFopenTell(&io);
+	io.close(&io);
+	if(r < 0 || entries.empty() || filesize < 0)
+		return -1;
+	return THEORAPLAYER_WriteSeekIndex(indexFilename, THEORAPLAYER_SEEKINDEX_WEBM, filesize, entries.data(), entries.size());
+} // WEBMPLAYER_BuildSeekIndex
+
+WebmPlayer::WebmPlayer()
+{
+
+}
+
+WebmPlayer::~WebmPlayer()
+{
+	//the state refers back to the decoder
+	delete _state;
+	delete _decoder;
+	delete _io;
+}
+
+int WebmPlayer::OpenDecode(const char* filename, THEORAPLAYER_VideoFormat outputFormat, THEORAPLAYER_Allocator* allocator)
+{
+	if(_decoder)
+		return -1;
+
+	FILE *f = fopen(filename, "rb");
+	if(f == NULL)
+	{
+		return -1;
+	} // if
+
+	if(!_io)
+	{
+		_io = new THEORAPLAYER_Io();
+		_io->read = IoFopenRead;
+		_io->close = IoFopenClose;
+		_io->userdata = f;
+		_io->seek = IoFopenSeek;
+		_io->tell = IoFopenTell;
+	}
+	return OpenDecode(_io, outputFormat, allocator);
+}
+
+int WebmPlayer::OpenDecode(THEORAPLAYER_Io* io, THEORAPLAYER_VideoFormat outputFormat, THEORAPLAYER_Allocator* allocator)
+{
+	if(_decoder)
+		return -1;
+
+	THEORAPLAYER_ConvertRowFn rowfn = nullptr;
+	switch(outputFormat)
+	{
+	case THEORAPLAYER_VIDFMT_YV12:
+	case THEORAPLAYER_VIDFMT_IYUV:
+		break;
+	case THEORAPLAYER_VIDFMT_RGB:
+	case THEORAPLAYER_VIDFMT_RGBA:
+	case THEORAPLAYER_VIDFMT_BGR:
+	case THEORAPLAYER_VIDFMT_BGRA:
+		rowfn = THEORAPLAYER_GetConvertRowFn(outputFormat, THEORAPLAYER_DetectConvertPath());
+		break;
+	default:
+		io->close(io);
+		return -1;
+	}
+
+	if(allocator && (!allocator->alloc || !allocator->free))
+	{
+		io->close(io);
+		return -1;
+	}
+
+	_decoder = new WEBMPLAYER_Decoder;
+	_decoder->vidfmt = outputFormat;
+	_decoder->rowfn = rowfn;
+	_decoder->io = io;
+	_decoder->userallocator = allocator;
+	return 1;
+}
+
+int WebmPlayer::SetThreads(unsigned int threads, WEBMPLAYER_ThreadMode mode)
+{
+	if(!_decoder || _state)
+		return -1;
+	if(mode != WEBMPLAYER_THREADS_ROWS && mode != WEBMPLAYER_THREADS_FRAMES)
+		return -1;
+
+	_decoder->threads = threads;
+	_decoder->threadmode = mode;
+	return 1;
+}
+
+int WebmPlayer::Prepare()
+{
+	//decoder should exist (OpenDecode has been called) but state should not because we will create it
+	if(!_decoder)
+		return -1;
+	if(_state)
+		return -1;
+
+	_state = new WEBMPLAYER_State;
+	_state->ctx = _decoder;
+	auto result = _state->Prepare();
+	if(result < 0)
+	{
+		delete _state;
+		_state = nullptr;
+	}
+	return result;
+}
+
+int WebmPlayer::SeekToMs(unsigned int ms)
+{
+	if(!_state)
+		return -1;
+
+	auto result = _state->Seek(ms);
+	//a failed seek leaves the demuxer in an unknown place, same as a decode error
+	if(result < 0)
+	{
+		delete _state;
+		_state = nullptr;
+	}
+	return result;
+}
+
+int WebmPlayer::LoadSeekIndex(const char* filename)
+{
+	if(!_decoder || !filename)
+		return -1;
+
+	unsigned char* data = NULL;
+	size_t size = 0;
+	if(THEORAPLAYER_ReadSeekIndex(filename, &data, &size) < 0)
+		return -1;
+	if(LoadSeekIndex(data, size) < 0)
+	{
+		delete[] data;
+		return -1;
+	}
+	delete[] _decoder->seekindexdata;
+	_decoder->seekindexdata = data;
+	return 1;
+}
+
+int WebmPlayer::LoadSeekIndex(const void* data, size_t size)
+{
+	if(!_decoder)
+		return -1;
+
+	const THEORAPLAYER_SeekIndexEntry* entries = NULL;
+	size_t count = 0;
+	if(THEORAPLAYER_OpenSeekIndex(data, size, THEORAPLAYER_SEEKINDEX_WEBM, _decoder->IoSize(), &entries, &count) < 0)
+		return -1;
+	_decoder->seekindex = entries;
+	_decoder->seekindexcount = count;
+	return 1;
+}
+
+int WebmPlayer::GetVideoFrame(THEORAPLAYER_VideoFrame* frame)
+{
+	if(!_state)
+		return -1;
+	if(!frame)
+		return -1;
+
+	auto result = _state->DecodeNextVideoFrame(frame);
+	//If we had a decode error, nuke the internal state and refuse to provide any more data
+	if(result < 0)
+	{
+		delete _state;
+		_state = nullptr;
+		return -1;
+	}
+	return result;
+}
+
+int WebmPlayer::SkipVideoFrame()
+{
+	if(!_state)
+		return -1;
+
+	auto result = _state->SkipVideoFrame();
+	//Same as GetVideoFrame, a decode error is the end of this player
+	if(result < 0)
+	{
+		delete _state;
+		_state = nullptr;
+		return -1;
+	}
+	return result;
+}
+
+void WebmPlayer::FreeFrameData(THEORAPLAYER_VideoFrame* frame)
+{
+	if(!_decoder || !frame)
+		return;
+	_decoder->Free(frame->pixels);
+	frame->pixels = nullptr;
+}
+
+int WebmPlayer::GetPlanarFrame(THEORAPLAYER_PlanarFrame* frame)
+{
+	if(!_state)
+		return -1;
+	if(!frame)
+		return -1;
+
+	auto result = _state->GetPlanarFrame(frame);
+	//Same as GetVideoFrame, a decode error is the end of this player
+	if(result < 0)
+	{
+		delete _state;
+		_state = nullptr;
+		return -1;
+	}
+	return result;
+}
+int WebmPlayer::AcquireFrame(WEBMPLAYER_PlanarFrame* frame)
+{
+	if(!_state)
+		return -1;
+	if(!frame)
+		return -1;
+
+	auto result = _state->AcquireFrame(frame);
+	//Same as GetVideoFrame, a decode error is the end of this player
+	if(result < 0)
+	{
+		delete _state;
+		_state = nullptr;
+		return -1;
+	}
+	return result;
+}
+
+void WebmPlayer::ReleaseFrame(WEBMPLAYER_PlanarFrame* frame)
+{
+	if(!_decoder || !frame || !frame->fb)
+		return;
+	_decoder->ReleaseBuffer(frame->fb);
+	frame->fb = nullptr;
+}
+
+int WebmPlayer::IsDecoding() const
+{
+	if(_decoder && _state && !_state->eos)
+		return 1;
+	return 0;
+}
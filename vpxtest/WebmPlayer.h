@@ -0,0 +1,115 @@
+// Copyright (c) Promit Roy.
+// All rights reserved.
+//
+// This code is licensed under the MIT License.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+//WebM (VP8/VP9) counterpart to TheoraPlayer, built on nestegg and libvpx.
+//It shares TheoraPlayer's Io, allocator, output formats and frame struct, so an engine can
+//push either kind of file through the same frame path.
+
+#ifndef WEBMPLAYER_H
+#define WEBMPLAYER_H
+#pragma once
+
+#include "TheoraPlayer.h"
+
+//How libvpx spreads decoding across threads
+enum WEBMPLAYER_ThreadMode
+{
+	WEBMPLAYER_THREADS_ROWS,    /* VP8 macroblock rows, VP9 tile columns plus loop filter rows. No added latency. */
+	WEBMPLAYER_THREADS_FRAMES   /* VP9 only: several frames in flight at once, for streams with few tiles. Adds a frame of latency per thread. */
+};
+
+//Read a WebM file through and write an index of its video keyframes to indexFilename, for LoadSeekIndex.
+//Returns 1 on success, -1 if the file can't be read or has no VP8 or VP9 track.
+int WEBMPLAYER_BuildSeekIndex(const char* filename, const char* indexFilename);
+
+//A decoded picture handed out without converting it. The planes point into a pooled buffer from the player's
+//allocator, which stays untouched until the frame is released, however far decoding moves on.
+struct WEBMPLAYER_PlanarFrame
+{
+	//Timestamp, size and Y, Cb and Cr planes, the same views GetPlanarFrame hands out, for the same upload path
+	THEORAPLAYER_PlanarFrame planar;
+	//The pooled buffer holding the planes, as it came from the allocator, so the caller can find it in its own memory
+	const void* buffer;
+	size_t buffersize;
+	//Owned by the player
+	struct WEBMPLAYER_FrameBuffer* fb;
+};
+
+class WebmPlayer
+{
+public:
+	WebmPlayer();
+	~WebmPlayer();
+
+	//Open a video file by name for decode to the specified output format.
+	//Frame pixels come from the allocator if one is supplied (it must outlive the player), or aligned malloc otherwise.
+	int OpenDecode(const char* filename, THEORAPLAYER_VideoFormat outputFormat, THEORAPLAYER_Allocator* allocator = nullptr);
+	//Open a video file with user-supplied IO for decode to the specified output format.
+	//nestegg needs seek and tell to find the cues; without them only straight playback works.
+	int OpenDecode(THEORAPLAYER_Io* io, THEORAPLAYER_VideoFormat outputFormat, THEORAPLAYER_Allocator* allocator = nullptr);
+
+	//Decoder thread count and mode. Call before Prepare. threads 0 (the default) picks a count from the CPU count
+	//and the frame size. Frame threading falls back to row threading for VP8.
+	int SetThreads(unsigned int threads, WEBMPLAYER_ThreadMode mode = WEBMPLAYER_THREADS_ROWS);
+
+	//Parse the headers and set up the decoder for the first video track
+	int Prepare();
+	//True if we are currently in the midst of decoding this video and not at the end of the stream
+	int IsDecoding() const;
+	//Jump so the next decoded frame is the first one with playms >= ms. Needs an Io with seek and tell.
+	//Finds the keyframe before the target through the seek index if one is loaded, otherwise the file's cues,
+	//or its clusters if it has none, and decodes forward without output. Returns 0 if ms is past the end.
+	int SeekToMs(unsigned int ms);
+	//Seek with an index from WEBMPLAYER_BuildSeekIndex: one jump straight to the keyframe's cluster, with no cues to load.
+	//Call after OpenDecode. An index built from a different file size is refused with -1.
+	int LoadSeekIndex(const char* filename);
+	//Same, with the index already in memory. It is used in place without a copy, so a mapping of the index file
+	//costs nothing to load. The memory must outlive the player.
+	int LoadSeekIndex(const void* data, size_t size);
+	//Decode the next frame and save the data to the supplied frame. If the frame does not have pixel data, one will be allocated.
+	int GetVideoFrame(THEORAPLAYER_VideoFrame* frame);
+	//Decode the next frame only to advance the decoder, without converting it. Returns 1 if a frame was skipped,
+	//with the same 0 and -1 results as GetVideoFrame.
+	int SkipVideoFrame();
+	//Free the previously allocated pixel data inside this frame.
+	void FreeFrameData(THEORAPLAYER_VideoFrame* frame);
+
+	//Decode the next frame and point the planes straight into libvpx's picture, with no conversion or copy, for VP8 too.
+	//Unlike AcquireFrame nothing is held, so the planes only stay valid until the next call that decodes or seeks.
+	//Returns 1 with a frame, with the same 0 and -1 results as GetVideoFrame.
+	int GetPlanarFrame(THEORAPLAYER_PlanarFrame* frame);
+
+	//Decode the next frame and hand out its planes without a copy. VP9 decodes straight into the pooled buffers;
+	//VP8 has no external buffer support in libvpx, so its frames are copied once into a pooled buffer.
+	//Returns 1 with a frame, 0 at the end of the stream, -1 on a decode error. Can be mixed with GetVideoFrame.
+	int AcquireFrame(WEBMPLAYER_PlanarFrame* frame);
+	//Hand the frame's buffer back to the pool. Safe to call from any thread, but every frame must be released before the player is destroyed.
+	void ReleaseFrame(WEBMPLAYER_PlanarFrame* frame);
+
+private:
+	struct WEBMPLAYER_Decoder* _decoder = nullptr;
+	struct WEBMPLAYER_State* _state = nullptr;
+	THEORAPLAYER_Io* _io = nullptr;
+};
+
+#endif
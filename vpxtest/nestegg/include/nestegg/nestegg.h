@@ -145,6 +145,15 @@ typedef struct {
   uint64_t  seek_preroll;/**< Nanoseconds that must be discarded after a seek. */
 } nestegg_audio_params;
 
+/** Packet reader counters.  @see nestegg_get_stats */
+typedef struct {
+  uint64_t packets;      /**< Packets read. */
+  uint64_t allocations;  /**< Heap allocations made for packet, frame and payload storage. */
+  uint64_t io_requests;  /**< Reads, seeks and tells made by the parser. */
+  uint64_t io_calls;     /**< Calls made to the user's IO callbacks.  The rest of
+                              io_requests were served from the read-ahead window. */
+} nestegg_stats;
+
 /** Logging callback function pointer. */
 typedef void (* nestegg_log)(nestegg * context, unsigned int severity, char const * format, ...);
 
@@ -209,9 +218,19 @@ int nestegg_get_cue_point(nestegg * context, unsigned int cluster_num,
     @retval -1 Error. */
 int nestegg_offset_seek(nestegg * context, uint64_t offset);
 
+/** Query the start of the cluster holding the last packet read from
+    @a context, as an offset #nestegg_offset_seek can return to.
+    @param context Stream context initialized by #nestegg_init.
+    @param offset  Storage for the absolute offset in bytes.
+    @retval  0 Success.
+    @retval -1 Error, or no packet has been read since the last seek. */
+int nestegg_last_cluster_offset(nestegg * context, int64_t * offset);
+
 /** Seek @a track to @a tstamp.  Stream seek will terminate at the earliest
     key point in the stream at or before @a tstamp.  Other tracks in the
     stream will output packets with unspecified but nearby timestamps.
+    Without cues the stream seeks to the start of the last cluster at or
+    before @a tstamp instead, found in the cluster index.
     @param context Stream context initialized by #nestegg_init.
     @param track   Zero based track number.
     @param tstamp  Absolute timestamp in nanoseconds.
@@ -219,6 +238,40 @@ int nestegg_offset_seek(nestegg * context, uint64_t offset);
     @retval -1 Error. */
 int nestegg_track_seek(nestegg * context, unsigned int track, uint64_t tstamp);
 
+/** Scan the cluster headers from the last indexed cluster to the end of the
+    stream, so later seeks in a file without cues need no scanning.  Clusters
+    are also indexed as packets are read, and #nestegg_track_seek scans as
+    far as it needs to when the file has no cues.
+    @param context Stream context initialized by #nestegg_init.
+    @retval  0 Success.
+    @retval -1 Error. */
+int nestegg_index_clusters(nestegg * context);
+
+/** Serialize the cluster index of @a context, so it can be stored beside the
+    file and handed to #nestegg_load_cluster_index on a later open.  The
+    index records the segment offset and the stream's length, so the IO
+    must be able to seek to the end and report it.
+    @param context Stream context initialized by #nestegg_init.
+    @param buffer  Storage for the index, or NULL to query its size.
+    @param length  Size of @a buffer on entry, bytes needed or written on
+                   return.
+    @retval  0 Success.
+    @retval -1 Error, or @a buffer is too small. */
+int nestegg_save_cluster_index(nestegg * context, unsigned char * buffer,
+                               size_t * length);
+
+/** Replace the cluster index of @a context with one written by
+    #nestegg_save_cluster_index for the same file.
+    @param context Stream context initialized by #nestegg_init.
+    @param buffer  Serialized index.
+    @param length  Size of @a buffer in bytes.
+    @retval  0 Success.
+    @retval -1 Error, the index is malformed, or was saved for a file with a
+               different segment offset or length (another file, or this
+               one before it grew), and was not loaded. */
+int nestegg_load_cluster_index(nestegg * context, unsigned char const * buffer,
+                               size_t length);
+
 /** Query the type specified by @a track.
     @param context Stream context initialized by #nestegg_init.
     @param track   Zero based track number.
@@ -298,6 +351,33 @@ int nestegg_track_default_duration(nestegg * context, unsigned int track,
     @retval -1 Error. */
 int nestegg_read_packet(nestegg * context, nestegg_packet ** packet);
 
+/** Read a packet of media data, reusing the storage of a previous packet.
+    If @a packet points to a packet from an earlier read on @a context, that
+    packet is recycled first and its memory (and that of any packets handed
+    back with #nestegg_recycle_packet) holds the new one, so a steady stream
+    is read without allocating.  The new packet may or may not be at the same
+    address.  On end of stream or error @a packet is set to NULL.
+    @param context Context returned by #nestegg_init.
+    @param packet  Storage for the returned nestegg_packet; NULL or a packet
+                   previously read from @a context.
+    @retval  1 Additional packets may be read in subsequent calls.
+    @retval  0 End of stream.
+    @retval -1 Error. */
+int nestegg_read_packet_into(nestegg * context, nestegg_packet ** packet);
+
+/** Hand a packet back to the context it was read from, which keeps its
+    memory for later reads instead of freeing it.
+    @param context Context the packet was read from.
+    @param packet  #nestegg_packet to be recycled. */
+void nestegg_recycle_packet(nestegg * context, nestegg_packet * packet);
+
+/** Query the packet reader counters of @a context.
+    @param context Stream context initialized by #nestegg_init.
+    @param stats   Storage for the counters.
+    @retval  0 Success.
+    @retval -1 Error. */
+int nestegg_get_stats(nestegg * context, nestegg_stats * stats);
+
 /** Destroy a nestegg_packet and free associated memory.
     @param packet #nestegg_packet to be freed. @see nestegg_read_packet */
 void nestegg_free_packet(nestegg_packet * packet);
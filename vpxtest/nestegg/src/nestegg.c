@@ -5,6 +5,7 @@
  * accompanying file LICENSE for details.
  */
 #include <assert.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -120,6 +121,25 @@ enum ebml_type_enum {
 #define LIMIT_BLOCK             (1 << 30)
 #define LIMIT_FRAME             (1 << 28)
 
+/* Recycled packet storage kept per context */
+#define POOL_PACKETS            16
+#define POOL_FRAMES             64
+#define POOL_FRAME_ROUNDING     4096
+
+/* Read-ahead window over the user's IO callbacks.  Reads at least half
+   this size go straight to the caller's memory, and skips of at least this
+   size seek instead of reading. */
+#define IO_BUFFER_SIZE          (64 * 1024)
+
+/* Serialized cluster index: magic, version, entry count, segment offset and
+   stream length, then position, timecode and flags per cluster, all little
+   endian.  The segment offset and stream length tie it to the file it was
+   saved for, as it was then. */
+#define CLUSTER_INDEX_MAGIC     "NECI"
+#define CLUSTER_INDEX_VERSION   2
+#define CLUSTER_INDEX_HEADER    32
+#define CLUSTER_INDEX_ENTRY     17
+
 /* Field Flags */
 #define DESC_FLAG_NONE          0
 #define DESC_FLAG_MULTI         (1 << 0)
@@ -311,9 +331,66 @@ struct saved_state {
 struct frame {
   unsigned char * data;
   size_t length;
+  size_t capacity;
   struct frame * next;
 };
 
+/* The user's IO plus a window of the stream read ahead of the parser, so
+   element headers and small fields are parsed from memory.  The parser's
+   position is offset + position; the user's stream sits at offset + length.
+   Without a buffer every call goes straight to the user. */
+struct buffered_io {
+  nestegg_io io;
+  unsigned char * buffer;
+  size_t length;
+  size_t position;
+  int64_t offset;
+  int64_t end;
+  nestegg_stats * stats;
+};
+
+/* One CueTrackPositions, flattened out of the cue point lists. */
+struct cue_entry {
+  uint64_t time;      /* CueTime, in timecode scale units */
+  uint64_t position;  /* cluster offset from the start of the segment */
+  uint64_t block;     /* block number within the cluster, 0 if not given */
+  unsigned int track; /* zero based track index */
+  unsigned int order; /* position in the file, to keep sorting stable */
+};
+
+/* The cues as flat arrays: every position in file order, and each track's
+   positions (the first per cue point) sorted by time for binary search.
+   Rebuilt when more cue points are parsed. */
+struct cue_index {
+  struct cue_entry * entries;
+  size_t count;
+  struct cue_entry * tracks;
+  size_t * track_start;
+  struct ebml_list_node * tail;
+};
+
+/* A cluster seen while reading packets or scanning cluster headers. */
+struct cluster_entry {
+  uint64_t position;  /* offset from the start of the segment */
+  uint64_t timecode;  /* cluster Timecode, in timecode scale units */
+  int next_known;     /* the following entry is the next cluster in the file */
+};
+
+/* Clusters sorted by position, for seeking in files without cues. */
+struct cluster_index {
+  struct cluster_entry * entries;
+  size_t count;
+  size_t capacity;
+};
+
+/* Cluster headers are scanned through a small window of their own, so a
+   scan reads a few bytes per cluster instead of a full read-ahead. */
+struct scan_window {
+  unsigned char data[256];
+  int64_t offset;
+  size_t length;
+};
+
 struct block_additional {
   unsigned int id;
   unsigned char * data;
@@ -323,17 +400,27 @@ struct block_additional {
 
 /* Public (opaque) Structures */
 struct nestegg {
-  nestegg_io * io;
+  struct buffered_io * io;
   nestegg_log log;
   struct pool_ctx * alloc_pool;
   uint64_t last_id;
   uint64_t last_size;
   int last_valid;
+  uint64_t last_header;
   struct list_node * ancestor;
   struct ebml ebml;
   struct segment segment;
   int64_t segment_offset;
   unsigned int track_count;
+  nestegg_packet * packet_pool;
+  unsigned int packet_pool_count;
+  struct frame * frame_pool;
+  unsigned int frame_pool_count;
+  nestegg_stats stats;
+  struct cue_index cue_index;
+  struct cluster_index cluster_index;
+  int64_t cluster_start;
+  int64_t cluster_previous;
 };
 
 struct nestegg_packet {
@@ -343,6 +430,7 @@ struct nestegg_packet {
   struct frame * frame;
   struct block_additional * block_additional;
   int64_t discard_padding;
+  nestegg_packet * next;
 };
 
 /* Element Descriptor */
@@ -545,24 +633,323 @@ ne_alloc(size_t size)
   return calloc(1, size);
 }
 
+static void *
+ne_packet_alloc(nestegg * ctx, size_t size)
+{
+  ctx->stats.allocations += 1;
+  return ne_alloc(size);
+}
+
+static nestegg_packet *
+ne_packet_get(nestegg * ctx)
+{
+  nestegg_packet * pkt;
+
+  pkt = ctx->packet_pool;
+  if (!pkt)
+    return ne_packet_alloc(ctx, sizeof(*pkt));
+
+  ctx->packet_pool = pkt->next;
+  ctx->packet_pool_count -= 1;
+  pkt->next = NULL;
+  return pkt;
+}
+
+static struct frame *
+ne_frame_get(nestegg * ctx, size_t length)
+{
+  struct frame * f;
+  size_t capacity;
+
+  f = ctx->frame_pool;
+  if (f) {
+    ctx->frame_pool = f->next;
+    ctx->frame_pool_count -= 1;
+    f->next = NULL;
+  } else {
+    f = ne_packet_alloc(ctx, sizeof(*f));
+    if (!f)
+      return NULL;
+  }
+
+  if (!f->data || f->capacity < length) {
+    /* Round up so a stream's frame sizes settle on a few buffer sizes. */
+    capacity = (length + POOL_FRAME_ROUNDING - 1) & ~(size_t) (POOL_FRAME_ROUNDING - 1);
+    if (capacity == 0)
+      capacity = POOL_FRAME_ROUNDING;
+    free(f->data);
+    f->data = malloc(capacity);
+    if (!f->data) {
+      free(f);
+      return NULL;
+    }
+    ctx->stats.allocations += 1;
+    f->capacity = capacity;
+  }
+  f->length = length;
+
+  return f;
+}
+
+/* Return a packet's storage to the context's pools, freeing whatever does
+   not fit. */
+static void
+ne_packet_recycle(nestegg * ctx, nestegg_packet * pkt)
+{
+  struct frame * frame;
+  struct block_additional * block_additional;
+
+  while (pkt->frame) {
+    frame = pkt->frame;
+    pkt->frame = frame->next;
+    if (ctx->frame_pool_count < POOL_FRAMES) {
+      frame->next = ctx->frame_pool;
+      ctx->frame_pool = frame;
+      ctx->frame_pool_count += 1;
+    } else {
+      free(frame->data);
+      free(frame);
+    }
+  }
+
+  while (pkt->block_additional) {
+    block_additional = pkt->block_additional;
+    pkt->block_additional = block_additional->next;
+    free(block_additional->data);
+    free(block_additional);
+  }
+
+  if (ctx->packet_pool_count < POOL_PACKETS) {
+    memset(pkt, 0, sizeof(*pkt));
+    pkt->next = ctx->packet_pool;
+    ctx->packet_pool = pkt;
+    ctx->packet_pool_count += 1;
+  } else {
+    free(pkt);
+  }
+}
+
+static int
+ne_io_user_read(struct buffered_io * io, void * buffer, size_t length)
+{
+  io->stats->io_calls += 1;
+  return io->io.read(buffer, length, io->io.userdata);
+}
+
+static int
+ne_io_user_seek(struct buffered_io * io, int64_t offset, int whence)
+{
+  io->stats->io_calls += 1;
+  return io->io.seek(offset, whence, io->io.userdata);
+}
+
+static int64_t
+ne_io_user_tell(struct buffered_io * io)
+{
+  io->stats->io_calls += 1;
+  return io->io.tell(io->io.userdata);
+}
+
+/* Length of the stream, leaving the user's position where it was. */
+static int64_t
+ne_io_length(struct buffered_io * io)
+{
+  int64_t pos, end;
+
+  pos = ne_io_user_tell(io);
+  if (pos < 0 || ne_io_user_seek(io, 0, NESTEGG_SEEK_END) != 0)
+    return -1;
+  end = ne_io_user_tell(io);
+  if (ne_io_user_seek(io, pos, NESTEGG_SEEK_SET) != 0)
+    return -1;
+  if (end >= 0)
+    io->end = end;
+  return end;
+}
+
+static struct buffered_io *
+ne_io_init(nestegg_io user, nestegg_stats * stats)
+{
+  struct buffered_io * io;
+
+  io = ne_alloc(sizeof(*io));
+  if (!io)
+    return NULL;
+  io->io = user;
+  io->stats = stats;
+
+  /* The window needs to know where the stream ends, because the user's read
+     is all or nothing and a short read at the end would lose data.  Streams
+     that can't say stay unbuffered. */
+  io->offset = ne_io_user_tell(io);
+  if (io->offset < 0)
+    return io;
+  if (ne_io_user_seek(io, 0, NESTEGG_SEEK_END) != 0)
+    return io;
+  io->end = ne_io_user_tell(io);
+  if (ne_io_user_seek(io, io->offset, NESTEGG_SEEK_SET) != 0) {
+    free(io);
+    return NULL;
+  }
+  if (io->end < io->offset)
+    return io;
+
+  io->buffer = malloc(IO_BUFFER_SIZE);
+  return io;
+}
+
+static void
+ne_io_destroy(struct buffered_io * io)
+{
+  if (!io)
+    return;
+  free(io->buffer);
+  free(io);
+}
+
+/* Refill the empty window with at least need bytes. */
+static int
+ne_io_fill(struct buffered_io * io, size_t need)
+{
+  int64_t pos;
+  size_t want;
+  int r;
+
+  pos = io->offset + io->length;
+  if (pos + (int64_t) need > io->end) {
+    /* The stream may have grown since we last looked. */
+    if (ne_io_user_seek(io, 0, NESTEGG_SEEK_END) != 0)
+      return -1;
+    io->end = ne_io_user_tell(io);
+    if (ne_io_user_seek(io, pos, NESTEGG_SEEK_SET) != 0)
+      return -1;
+  }
+
+  want = IO_BUFFER_SIZE;
+  if (io->end - pos < (int64_t) want)
+    want = io->end > pos ? (size_t) (io->end - pos) : 0;
+  if (want < need)
+    want = need; /* let the user's read report the end of the stream */
+
+  io->offset = pos;
+  io->length = 0;
+  io->position = 0;
+  r = ne_io_user_read(io, io->buffer, want);
+  if (r != 1)
+    return r;
+  io->length = want;
+
+  return 1;
+}
+
 static int
-ne_io_read(nestegg_io * io, void * buffer, size_t length)
+ne_io_read(struct buffered_io * io, void * buffer, size_t length)
 {
-  return io->read(buffer, length, io->userdata);
+  unsigned char * p = buffer;
+  size_t avail;
+  int r;
+
+  io->stats->io_requests += 1;
+  if (!io->buffer)
+    return ne_io_user_read(io, buffer, length);
+
+  while (length > 0) {
+    avail = io->length - io->position;
+    if (avail > 0) {
+      if (avail > length)
+        avail = length;
+      memcpy(p, io->buffer + io->position, avail);
+      io->position += avail;
+      p += avail;
+      length -= avail;
+    } else if (length >= IO_BUFFER_SIZE / 2) {
+      /* Big payloads skip the window. */
+      io->offset += io->length;
+      io->length = 0;
+      io->position = 0;
+      r = ne_io_user_read(io, p, length);
+      if (r != 1)
+        return r;
+      io->offset += length;
+      length = 0;
+    } else {
+      r = ne_io_fill(io, length);
+      if (r != 1)
+        return r;
+    }
+  }
+
+  return 1;
+}
+
+static int64_t
+ne_io_tell(struct buffered_io * io)
+{
+  io->stats->io_requests += 1;
+  if (!io->buffer)
+    return ne_io_user_tell(io);
+  return io->offset + io->position;
 }
 
 static int
-ne_io_seek(nestegg_io * io, int64_t offset, int whence)
+ne_io_seek(struct buffered_io * io, int64_t offset, int whence)
 {
-  return io->seek(offset, whence, io->userdata);
+  int r;
+
+  io->stats->io_requests += 1;
+  if (!io->buffer)
+    return ne_io_user_seek(io, offset, whence);
+
+  if (whence == NESTEGG_SEEK_CUR) {
+    offset += io->offset + io->position;
+    whence = NESTEGG_SEEK_SET;
+  }
+
+  /* Seeks within the window, such as backing up over a peeked element, are
+     free. */
+  if (whence == NESTEGG_SEEK_SET && offset >= io->offset &&
+      offset <= io->offset + (int64_t) io->length) {
+    io->position = offset - io->offset;
+    return 0;
+  }
+
+  r = ne_io_user_seek(io, offset, whence);
+  if (r != 0)
+    return r;
+  if (whence == NESTEGG_SEEK_END) {
+    offset = ne_io_user_tell(io);
+    if (offset < 0)
+      return -1;
+  }
+  io->offset = offset;
+  io->length = 0;
+  io->position = 0;
+
+  return 0;
 }
 
 static int
-ne_io_read_skip(nestegg_io * io, size_t length)
+ne_io_read_skip(struct buffered_io * io, size_t length)
 {
   size_t get;
   unsigned char buf[8192];
   int r = 1;
+  int64_t target;
+
+  if (io->buffer) {
+    get = io->length - io->position;
+    if (length <= get) {
+      io->stats->io_requests += 1;
+      io->position += length;
+      return 1;
+    }
+
+    /* Seek over large elements instead of reading them.  Past the end of
+       the stream as we know it, read so the stream can report its end. */
+    target = io->offset + io->position + length;
+    if (length - get >= IO_BUFFER_SIZE && target <= io->end)
+      return ne_io_seek(io, target, NESTEGG_SEEK_SET) == 0 ? 1 : -1;
+  }
 
   while (length > 0) {
     get = length < sizeof(buf) ? length : sizeof(buf);
@@ -575,14 +962,19 @@ ne_io_read_skip(nestegg_io * io, size_t length)
   return r;
 }
 
-static int64_t
-ne_io_tell(nestegg_io * io)
+/* Empty the window and put the user's stream back at offset, after
+   something other than the window moved it. */
+static int
+ne_io_reset(struct buffered_io * io, int64_t offset)
 {
-  return io->tell(io->userdata);
+  io->offset = offset;
+  io->length = 0;
+  io->position = 0;
+  return ne_io_user_seek(io, offset, NESTEGG_SEEK_SET);
 }
 
 static int
-ne_bare_read_vint(nestegg_io * io, uint64_t * value, uint64_t * length, enum vint_mask maskflag)
+ne_bare_read_vint(struct buffered_io * io, uint64_t * value, uint64_t * length, enum vint_mask maskflag)
 {
   int r;
   unsigned char b;
@@ -619,19 +1011,19 @@ ne_bare_read_vint(nestegg_io * io, uint64_t * value, uint64_t * length, enum vin
 }
 
 static int
-ne_read_id(nestegg_io * io, uint64_t * value, uint64_t * length)
+ne_read_id(struct buffered_io * io, uint64_t * value, uint64_t * length)
 {
   return ne_bare_read_vint(io, value, length, MASK_NONE);
 }
 
 static int
-ne_read_vint(nestegg_io * io, uint64_t * value, uint64_t * length)
+ne_read_vint(struct buffered_io * io, uint64_t * value, uint64_t * length)
 {
   return ne_bare_read_vint(io, value, length, MASK_FIRST_BIT);
 }
 
 static int
-ne_read_svint(nestegg_io * io, int64_t * value, uint64_t * length)
+ne_read_svint(struct buffered_io * io, int64_t * value, uint64_t * length)
 {
   int r;
   uint64_t uvalue;
@@ -653,7 +1045,7 @@ ne_read_svint(nestegg_io * io, int64_t * value, uint64_t * length)
 }
 
 static int
-ne_read_uint(nestegg_io * io, uint64_t * val, uint64_t length)
+ne_read_uint(struct buffered_io * io, uint64_t * val, uint64_t length)
 {
   unsigned char b;
   int r;
@@ -675,7 +1067,7 @@ ne_read_uint(nestegg_io * io, uint64_t * val, uint64_t length)
 }
 
 static int
-ne_read_int(nestegg_io * io, int64_t * val, uint64_t length)
+ne_read_int(struct buffered_io * io, int64_t * val, uint64_t length)
 {
   int r;
   uint64_t uval, base;
@@ -702,7 +1094,7 @@ ne_read_int(nestegg_io * io, int64_t * val, uint64_t length)
 }
 
 static int
-ne_read_float(nestegg_io * io, double * val, uint64_t length)
+ne_read_float(struct buffered_io * io, double * val, uint64_t length)
 {
   union {
     uint64_t u;
@@ -891,6 +1283,7 @@ static int
 ne_peek_element(nestegg * ctx, uint64_t * id, uint64_t * size)
 {
   int r;
+  uint64_t id_length, size_length;
 
   if (ctx->last_valid) {
     if (id)
@@ -900,13 +1293,14 @@ ne_peek_element(nestegg * ctx, uint64_t * id, uint64_t * size)
     return 1;
   }
 
-  r = ne_read_id(ctx->io, &ctx->last_id, NULL);
+  r = ne_read_id(ctx->io, &ctx->last_id, &id_length);
   if (r != 1)
     return r;
 
-  r = ne_read_vint(ctx->io, &ctx->last_size, NULL);
+  r = ne_read_vint(ctx->io, &ctx->last_size, &size_length);
   if (r != 1)
     return r;
+  ctx->last_header = id_length + size_length;
 
   if (id)
     *id = ctx->last_id;
@@ -1065,6 +1459,11 @@ ne_parse(nestegg * ctx, struct ebml_element_desc * top_level, int64_t max_offset
         break;
       assert(id == peeked_id);
 
+      /* Remember where a cluster starts until its first block gives its
+         timecode for the cluster index. */
+      if (element->id == ID_CLUSTER)
+        ctx->cluster_start = ne_io_tell(ctx->io) - ctx->last_header;
+
       if (element->flags & DESC_FLAG_OFFSET) {
         data_offset = (int64_t *) (ctx->ancestor->data + element->data_offset);
         *data_offset = ne_io_tell(ctx->io);
@@ -1136,7 +1535,7 @@ ne_xiph_lace_value(unsigned char ** np)
 }
 
 static int
-ne_read_xiph_lace_value(nestegg_io * io, uint64_t * value, size_t * consumed)
+ne_read_xiph_lace_value(struct buffered_io * io, uint64_t * value, size_t * consumed)
 {
   int r;
   uint64_t lace;
@@ -1159,7 +1558,7 @@ ne_read_xiph_lace_value(nestegg_io * io, uint64_t * value, size_t * consumed)
 }
 
 static int
-ne_read_xiph_lacing(nestegg_io * io, size_t block, size_t * read, uint64_t n, uint64_t * sizes)
+ne_read_xiph_lacing(struct buffered_io * io, size_t block, size_t * read, uint64_t n, uint64_t * sizes)
 {
   int r;
   size_t i = 0;
@@ -1182,7 +1581,7 @@ ne_read_xiph_lacing(nestegg_io * io, size_t block, size_t * read, uint64_t n, ui
 }
 
 static int
-ne_read_ebml_lacing(nestegg_io * io, size_t block, size_t * read, uint64_t n, uint64_t * sizes)
+ne_read_ebml_lacing(struct buffered_io * io, size_t block, size_t * read, uint64_t n, uint64_t * sizes)
 {
   int r;
   uint64_t lace, sum, length;
@@ -1278,6 +1677,52 @@ ne_find_track_entry(nestegg * ctx, unsigned int track)
   return NULL;
 }
 
+/* Add the cluster at position (from the start of the segment) to the index,
+   and mark it as following the cluster at previous unless that is -1.  Sets
+   *entry to its place in the index. */
+static int
+ne_index_cluster(nestegg * ctx, uint64_t position, uint64_t timecode, int64_t previous, size_t * entry)
+{
+  struct cluster_index * index = &ctx->cluster_index;
+  struct cluster_entry * entries;
+  size_t lo = 0, hi = index->count, mid, capacity;
+
+  /* Reading packets and scanning mostly append. */
+  if (hi > 0 && index->entries[hi - 1].position < position)
+    lo = hi;
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (index->entries[mid].position < position)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if (lo == index->count || index->entries[lo].position != position) {
+    if (index->count == index->capacity) {
+      capacity = index->capacity ? index->capacity * 2 : 256;
+      entries = realloc(index->entries, capacity * sizeof(*entries));
+      if (!entries)
+        return -1;
+      index->entries = entries;
+      index->capacity = capacity;
+    }
+    memmove(&index->entries[lo + 1], &index->entries[lo],
+            (index->count - lo) * sizeof(*index->entries));
+    index->entries[lo].position = position;
+    index->entries[lo].timecode = timecode;
+    index->entries[lo].next_known = 0;
+    index->count += 1;
+  }
+
+  if (previous >= 0 && lo > 0 && index->entries[lo - 1].position == (uint64_t) previous)
+    index->entries[lo - 1].next_known = 1;
+
+  if (entry)
+    *entry = lo;
+  return 0;
+}
+
 static int
 ne_read_block(nestegg * ctx, uint64_t block_id, uint64_t block_size, nestegg_packet ** data)
 {
@@ -1390,11 +1835,20 @@ ne_read_block(nestegg * ctx, uint64_t block_id, uint64_t block_size, nestegg_pac
   if (ne_get_uint(cluster->timecode, &cluster_tc) != 0)
     return -1;
 
+  /* The first block of a cluster indexes it.  Running out of memory only
+     leaves a gap in the index. */
+  if (ctx->cluster_start >= ctx->segment_offset) {
+    ne_index_cluster(ctx, ctx->cluster_start - ctx->segment_offset, cluster_tc,
+                     ctx->cluster_previous, NULL);
+    ctx->cluster_previous = ctx->cluster_start - ctx->segment_offset;
+    ctx->cluster_start = -1;
+  }
+
   abs_timecode = timecode + cluster_tc;
   if (abs_timecode < 0)
     return -1;
 
-  pkt = ne_alloc(sizeof(*pkt));
+  pkt = ne_packet_get(ctx);
   if (!pkt)
     return -1;
   pkt->track = track;
@@ -1406,36 +1860,30 @@ ne_read_block(nestegg * ctx, uint64_t block_id, uint64_t block_size, nestegg_pac
   last = NULL;
   for (i = 0; i < frames; ++i) {
     if (frame_sizes[i] > LIMIT_FRAME) {
-      nestegg_free_packet(pkt);
+      ne_packet_recycle(ctx, pkt);
       return -1;
     }
-    f = ne_alloc(sizeof(*f));
+    f = ne_frame_get(ctx, frame_sizes[i]);
     if (!f) {
-      nestegg_free_packet(pkt);
-      return -1;
-    }
-    f->data = ne_alloc(frame_sizes[i]);
-    if (!f->data) {
-      free(f);
-      nestegg_free_packet(pkt);
-      return -1;
-    }
-    f->length = frame_sizes[i];
-    r = ne_io_read(ctx->io, f->data, frame_sizes[i]);
-    if (r != 1) {
-      free(f->data);
-      free(f);
-      nestegg_free_packet(pkt);
+      ne_packet_recycle(ctx, pkt);
       return -1;
     }
 
+    /* Link the frame in first so the packet owns it if the read fails. */
     if (!last)
       pkt->frame = f;
     else
       last->next = f;
     last = f;
+
+    r = ne_io_read(ctx->io, f->data, frame_sizes[i]);
+    if (r != 1) {
+      ne_packet_recycle(ctx, pkt);
+      return -1;
+    }
   }
 
+  ctx->stats.packets += 1;
   *data = pkt;
 
   return 1;
@@ -1575,7 +2023,7 @@ ne_read_block_additions(nestegg * ctx, nestegg_packet * pkt)
         has_data = 1;
         data_size = size;
         if (size != 0) {
-          data = ne_alloc(size);
+          data = ne_packet_alloc(ctx, size);
           r = ne_io_read(ctx->io, data, size);
           if (r != 1) {
             free(data);
@@ -1597,7 +2045,7 @@ ne_read_block_additions(nestegg * ctx, nestegg_packet * pkt)
       return -1;
     }
 
-    block_additional = ne_alloc(sizeof(*block_additional));
+    block_additional = ne_packet_alloc(ctx, sizeof(*block_additional));
     block_additional->next = pkt->block_additional;
     block_additional->id = add_id;
     block_additional->data = data;
@@ -1651,54 +2099,404 @@ ne_find_seek_for_id(struct ebml_list_node * seek_head, uint64_t id)
   return NULL;
 }
 
-static struct cue_track_positions *
-ne_find_cue_position_for_track(nestegg * ctx, struct ebml_list_node * node, unsigned int track)
+static void
+ne_free_cue_index(struct cue_index * index)
 {
-  struct cue_track_positions * pos = NULL;
-  uint64_t track_number;
-  unsigned int t;
+  free(index->entries);
+  free(index->tracks);
+  free(index->track_start);
+  memset(index, 0, sizeof(*index));
+}
 
-  while (node) {
-    assert(node->id == ID_CUE_TRACK_POSITIONS);
-    pos = node->data;
-    if (ne_get_uint(pos->track, &track_number) != 0)
-      return NULL;
+static int
+ne_compare_cue_entries(void const * a, void const * b)
+{
+  struct cue_entry const * x = a;
+  struct cue_entry const * y = b;
 
-    if (ne_map_track_number_to_index(ctx, track_number, &t) != 0)
-      return NULL;
+  if (x->track != y->track)
+    return x->track < y->track ? -1 : 1;
+  if (x->time != y->time)
+    return x->time < y->time ? -1 : 1;
+  if (x->order != y->order)
+    return x->order < y->order ? -1 : 1;
+  return 0;
+}
+
+static int
+ne_build_cue_index(nestegg * ctx, struct cue_index * index)
+{
+  struct ebml_list_node * node, * pos_node;
+  struct cue_point * c;
+  struct cue_track_positions * pos;
+  struct cue_entry * e;
+  uint64_t time, track_number, cluster_position, block;
+  size_t count = 0, per_track = 0, first, i;
+  unsigned int track, t;
+
+  for (node = ctx->segment.cues.cue_point.head; node; node = node->next) {
+    c = node->data;
+    for (pos_node = c->cue_track_positions.head; pos_node; pos_node = pos_node->next)
+      count += 1;
+  }
+  if (count == 0 || count > UINT_MAX)
+    return -1;
 
-    if (t == track)
-      return pos;
+  index->entries = malloc(count * sizeof(*index->entries));
+  index->tracks = malloc(count * sizeof(*index->tracks));
+  index->track_start = calloc(ctx->track_count + 1, sizeof(*index->track_start));
+  if (!index->entries || !index->tracks || !index->track_start)
+    return -1;
 
-    node = node->next;
+  for (node = ctx->segment.cues.cue_point.head; node; node = node->next) {
+    assert(node->id == ID_CUE_POINT);
+    c = node->data;
+    if (ne_get_uint(c->time, &time) != 0)
+      return -1;
+
+    /* Only the first position for a track in a cue point counts when
+       seeking. */
+    first = index->count;
+    for (pos_node = c->cue_track_positions.head; pos_node; pos_node = pos_node->next) {
+      assert(pos_node->id == ID_CUE_TRACK_POSITIONS);
+      pos = pos_node->data;
+      if (ne_get_uint(pos->track, &track_number) != 0)
+        return -1;
+      if (ne_map_track_number_to_index(ctx, track_number, &track) != 0)
+        return -1;
+      if (ne_get_uint(pos->cluster_position, &cluster_position) != 0)
+        return -1;
+      if (ne_get_uint(pos->block_number, &block) != 0)
+        block = 0;
+
+      e = &index->entries[index->count];
+      e->time = time;
+      e->position = cluster_position;
+      e->block = block;
+      e->track = track;
+      e->order = (unsigned int) index->count;
+      index->count += 1;
+
+      for (i = first; i < index->count - 1; ++i)
+        if (index->entries[i].track == track)
+          break;
+      if (i == index->count - 1)
+        index->tracks[per_track++] = *e;
+    }
   }
 
-  return NULL;
+  qsort(index->tracks, per_track, sizeof(*index->tracks), ne_compare_cue_entries);
+  for (i = 0; i < per_track; ++i)
+    index->track_start[index->tracks[i].track + 1] = i + 1;
+  for (t = 1; t <= ctx->track_count; ++t)
+    if (index->track_start[t] < index->track_start[t - 1])
+      index->track_start[t] = index->track_start[t - 1];
+
+  index->tail = ctx->segment.cues.cue_point.tail;
+  return 0;
 }
 
-static struct cue_point *
-ne_find_cue_point_for_tstamp(nestegg * ctx, struct ebml_list_node * cue_point, unsigned int track, uint64_t scale, uint64_t tstamp)
+/* The cue index for the cue points parsed so far, or NULL if there are none
+   or they can't be indexed. */
+static struct cue_index *
+ne_get_cue_index(nestegg * ctx)
 {
-  uint64_t time;
-  struct cue_point * c, * prev = NULL;
+  struct cue_index * index = &ctx->cue_index;
 
-  while (cue_point) {
-    assert(cue_point->id == ID_CUE_POINT);
-    c = cue_point->data;
+  if (!ctx->segment.cues.cue_point.tail)
+    return NULL;
+  if (index->tail == ctx->segment.cues.cue_point.tail)
+    return index;
 
-    if (!prev)
-      prev = c;
+  ne_free_cue_index(index);
+  if (ne_build_cue_index(ctx, index) != 0) {
+    ne_free_cue_index(index);
+    return NULL;
+  }
+  return index;
+}
 
-    if (ne_get_uint(c->time, &time) == 0 && time * scale > tstamp)
+/* The last cue for track at or before tstamp, or the track's first cue if
+   tstamp comes before all of them. */
+static struct cue_entry *
+ne_find_cue_for_tstamp(struct cue_index * index, unsigned int track, uint64_t scale, uint64_t tstamp)
+{
+  size_t lo, hi, mid, first;
+
+  first = index->track_start[track];
+  lo = first;
+  hi = index->track_start[track + 1];
+  if (lo == hi)
+    return NULL;
+
+  /* Find the first cue after tstamp. */
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (index->tracks[mid].time * scale > tstamp)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+
+  return &index->tracks[lo > first ? lo - 1 : first];
+}
+
+/* The last indexed cluster at or before tstamp, or NULL if the index starts
+   after it. */
+static struct cluster_entry *
+ne_find_cluster_for_tstamp(struct cluster_index * index, uint64_t scale, uint64_t tstamp)
+{
+  size_t lo = 0, hi = index->count, mid;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (index->entries[mid].timecode * scale > tstamp)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+
+  return lo > 0 ? &index->entries[lo - 1] : NULL;
+}
+
+static int
+ne_buf_read_vint(unsigned char const * p, size_t avail, uint64_t * value,
+                 uint64_t * length, enum vint_mask maskflag)
+{
+  unsigned int count = 1, mask = 1 << 7, i;
+
+  if (avail < 1)
+    return 0;
+
+  while (count < 8 && (p[0] & mask) == 0) {
+    mask >>= 1;
+    count += 1;
+  }
+  if (count > avail)
+    return 0;
+
+  *length = count;
+  *value = maskflag == MASK_FIRST_BIT ? p[0] & ~mask : p[0];
+  for (i = 1; i < count; ++i)
+    *value = (*value << 8) | p[i];
+
+  return 1;
+}
+
+/* Point *p at the bytes from pos in the scan window, reading them in if
+   needed, and set *avail to how many there are up to need or the end of the
+   stream. */
+static int
+ne_scan_fill(struct buffered_io * io, struct scan_window * w, int64_t pos, size_t need,
+             unsigned char const ** p, size_t * avail)
+{
+  size_t want;
+
+  if (pos < w->offset || pos + (int64_t) need > w->offset + (int64_t) w->length) {
+    if (pos + (int64_t) need > io->end) {
+      /* The stream may have grown since we last looked. */
+      if (ne_io_user_seek(io, 0, NESTEGG_SEEK_END) != 0)
+        return -1;
+      io->end = ne_io_user_tell(io);
+      if (io->end < 0)
+        return -1;
+    }
+
+    want = sizeof(w->data);
+    if (io->end - pos < (int64_t) want)
+      want = io->end > pos ? (size_t) (io->end - pos) : 0;
+    w->offset = pos;
+    w->length = 0;
+    if (want > 0) {
+      if (ne_io_user_seek(io, pos, NESTEGG_SEEK_SET) != 0)
+        return -1;
+      if (ne_io_user_read(io, w->data, want) != 1)
+        return -1;
+      w->length = want;
+    }
+  }
+
+  *p = w->data + (pos - w->offset);
+  *avail = (size_t) (w->offset + (int64_t) w->length - pos);
+  if (*avail > need)
+    *avail = need;
+  return 0;
+}
+
+/* Read the ID and size of the element at pos.  Returns 0 at the end of the
+   stream. */
+static int
+ne_scan_element(struct buffered_io * io, struct scan_window * w, int64_t pos,
+                uint64_t * id, uint64_t * size, uint64_t * header, int * unknown)
+{
+  unsigned char const * p;
+  size_t avail;
+  uint64_t id_length, size_length;
+
+  if (ne_scan_fill(io, w, pos, 16, &p, &avail) != 0)
+    return -1;
+  if (!ne_buf_read_vint(p, avail, id, &id_length, MASK_NONE) ||
+      !ne_buf_read_vint(p + id_length, avail - id_length, size, &size_length, MASK_FIRST_BIT))
+    return 0;
+
+  *header = id_length + size_length;
+  *unknown = *size == (1ULL << (7 * size_length)) - 1;
+  return 1;
+}
+
+/* Read the Timecode of the cluster whose data starts at pos.  It comes
+   first, after at most a CRC-32 or Void.  Returns 0 if it isn't there. */
+static int
+ne_scan_cluster_timecode(struct buffered_io * io, struct scan_window * w, int64_t pos,
+                         uint64_t * timecode)
+{
+  unsigned char const * p;
+  size_t avail, i;
+  uint64_t id, size, header;
+  int r, unknown, children;
+
+  for (children = 0; children < 3; ++children) {
+    r = ne_scan_element(io, w, pos, &id, &size, &header, &unknown);
+    if (r != 1)
+      return r;
+
+    if (id == ID_TIMECODE) {
+      if (unknown || size > 8)
+        return 0;
+      if (ne_scan_fill(io, w, pos + header, size, &p, &avail) != 0)
+        return -1;
+      if (avail < size)
+        return 0;
+      *timecode = 0;
+      for (i = 0; i < size; ++i)
+        *timecode = (*timecode << 8) | p[i];
+      return 1;
+    }
+
+    if ((id != ID_CRC32 && id != ID_VOID) || unknown)
+      return 0;
+    pos += header + size;
+  }
+
+  return 0;
+}
+
+/* Index the clusters from the segment level element at pos up to the first
+   one after tstamp, reading only their headers.  Runs already indexed are
+   skipped.  Reaching the end of the segment is not an error. */
+static int
+ne_scan_clusters(nestegg * ctx, int64_t pos, uint64_t tstamp)
+{
+  struct cluster_index * index = &ctx->cluster_index;
+  struct scan_window w;
+  uint64_t id, size, header, timecode, scale, relative;
+  int64_t saved, previous = -1;
+  size_t entry;
+  int r, unknown;
+
+  /* Scanning needs random access and a known end, same as the window. */
+  if (!ctx->io->buffer)
+    return -1;
+
+  saved = ne_io_tell(ctx->io);
+  if (saved < 0)
+    return -1;
+  scale = ne_get_timecode_scale(ctx);
+  w.offset = 0;
+  w.length = 0;
+
+  ctx->log(ctx, NESTEGG_LOG_DEBUG, "seek: scanning cluster headers");
+  for (;;) {
+    r = ne_scan_element(ctx->io, &w, pos, &id, &size, &header, &unknown);
+    if (r != 1)
+      break;
+
+    if (id != ID_CLUSTER) {
+      /* Segment level IDs are all four bytes long, apart from Void and
+         CRC-32; anything else means the segment is over. */
+      if (((id & 0xff000000) == 0 && id != ID_VOID && id != ID_CRC32) || unknown)
+        break;
+      pos += header + size;
+      previous = -1;
+      continue;
+    }
+
+    r = ne_scan_cluster_timecode(ctx->io, &w, pos + header, &timecode);
+    if (r != 1)
+      break;
+    relative = pos - ctx->segment_offset;
+    r = ne_index_cluster(ctx, relative, timecode, previous, &entry);
+    if (r != 0)
+      break;
+    if (timecode * scale > tstamp)
       break;
 
-    if (ne_find_cue_position_for_track(ctx, c->cue_track_positions.head, track) != NULL)
-      prev = c;
+    /* Follow clusters already known to be consecutive. */
+    if (index->entries[entry].next_known &&
+        index->entries[entry + 1].timecode * scale <= tstamp) {
+      while (index->entries[entry].next_known &&
+             index->entries[entry + 1].timecode * scale <= tstamp)
+        entry += 1;
+      pos = ctx->segment_offset + index->entries[entry].position;
+      previous = index->entries[entry - 1].position;
+      continue;
+    }
+    previous = relative;
 
-    cue_point = cue_point->next;
+    if (!unknown) {
+      pos += header + size;
+      continue;
+    }
+
+    /* Live recordings leave the cluster size unknown, so walk its children
+       to the next segment level element. */
+    pos += header;
+    for (;;) {
+      r = ne_scan_element(ctx->io, &w, pos, &id, &size, &header, &unknown);
+      if (r != 1 || (id & 0xff000000) != 0)
+        break;
+      if (unknown) {
+        r = 0;
+        break;
+      }
+      pos += header + size;
+    }
+    if (r != 1)
+      break;
   }
 
-  return prev;
+  if (ne_io_reset(ctx->io, saved) != 0)
+    return -1;
+  return r < 0 ? -1 : 0;
+}
+
+/* Find the cluster to seek to for tstamp in a file without cues, scanning
+   past the end of what is indexed if needed. */
+static int
+ne_find_cluster_position(nestegg * ctx, uint64_t tstamp, uint64_t * position)
+{
+  struct cluster_index * index = &ctx->cluster_index;
+  struct cluster_entry * entry;
+  uint64_t scale;
+
+  scale = ne_get_timecode_scale(ctx);
+  entry = ne_find_cluster_for_tstamp(index, scale, tstamp);
+
+  /* Without the next cluster in the index there may be a closer one. */
+  if (!entry || !entry->next_known) {
+    if (ne_scan_clusters(ctx, entry ? ctx->segment_offset + (int64_t) entry->position
+                                    : ctx->segment_offset,
+                         tstamp) != 0)
+      return -1;
+    entry = ne_find_cluster_for_tstamp(index, scale, tstamp);
+    if (!entry && index->count > 0)
+      entry = &index->entries[0];
+    if (!entry)
+      return -1;
+  }
+
+  *position = entry->position;
+  return 0;
 }
 
 static int
@@ -1853,12 +2651,11 @@ ne_match_webm(nestegg_io io, int64_t max_offset)
   if (!ctx)
     return -1;
 
-  ctx->io = ne_alloc(sizeof(*ctx->io));
+  ctx->io = ne_io_init(io, &ctx->stats);
   if (!ctx->io) {
     nestegg_destroy(ctx);
     return -1;
   }
-  *ctx->io = io;
   ctx->alloc_pool = ne_pool_init();
   if (!ctx->alloc_pool) {
     nestegg_destroy(ctx);
@@ -1911,12 +2708,11 @@ nestegg_init(nestegg ** context, nestegg_io io, nestegg_log callback, int64_t ma
   if (!ctx)
     return -1;
 
-  ctx->io = ne_alloc(sizeof(*ctx->io));
+  ctx->io = ne_io_init(io, &ctx->stats);
   if (!ctx->io) {
     nestegg_destroy(ctx);
     return -1;
   }
-  *ctx->io = io;
   ctx->log = callback;
   ctx->alloc_pool = ne_pool_init();
   if (!ctx->alloc_pool) {
@@ -1927,6 +2723,9 @@ nestegg_init(nestegg ** context, nestegg_io io, nestegg_log callback, int64_t ma
   if (!ctx->log)
     ctx->log = ne_null_log_callback;
 
+  ctx->cluster_start = -1;
+  ctx->cluster_previous = -1;
+
   r = ne_peek_element(ctx, &id, NULL);
   if (r != 1) {
     nestegg_destroy(ctx);
@@ -1991,10 +2790,27 @@ nestegg_init(nestegg ** context, nestegg_io io, nestegg_log callback, int64_t ma
 void
 nestegg_destroy(nestegg * ctx)
 {
+  nestegg_packet * pkt;
+  struct frame * frame;
+
+  while (ctx->packet_pool) {
+    pkt = ctx->packet_pool;
+    ctx->packet_pool = pkt->next;
+    free(pkt);
+  }
+  while (ctx->frame_pool) {
+    frame = ctx->frame_pool;
+    ctx->frame_pool = frame->next;
+    free(frame->data);
+    free(frame);
+  }
+
   while (ctx->ancestor)
     ne_ctx_pop(ctx);
+  ne_free_cue_index(&ctx->cue_index);
+  free(ctx->cluster_index.entries);
   ne_pool_destroy(ctx->alloc_pool);
-  free(ctx->io);
+  ne_io_destroy(ctx->io);
   free(ctx);
 }
 
@@ -2031,14 +2847,7 @@ int
 nestegg_get_cue_point(nestegg * ctx, unsigned int cluster_num, int64_t max_offset,
                       int64_t * start_pos, int64_t * end_pos, uint64_t * tstamp)
 {
-  int range_obtained = 0;
-  unsigned int cluster_count = 0;
-  struct cue_point * cue_point;
-  struct cue_track_positions * pos;
-  uint64_t seek_pos, track_number, tc_scale, time;
-  struct ebml_list_node * cues_node = ctx->segment.cues.cue_point.head;
-  struct ebml_list_node * cue_pos_node = NULL;
-  unsigned int track = 0, track_count = 0, track_index;
+  struct cue_index * index;
 
   if (!start_pos || !end_pos || !tstamp)
     return -1;
@@ -2048,52 +2857,23 @@ nestegg_get_cue_point(nestegg * ctx, unsigned int cluster_num, int64_t max_offse
   *end_pos = -1;
   *tstamp = 0;
 
-  if (!cues_node) {
+  if (!ctx->segment.cues.cue_point.head) {
     ne_init_cue_points(ctx, max_offset);
-    cues_node = ctx->segment.cues.cue_point.head;
     /* Verify cues have been added to context. */
-    if (!cues_node)
+    if (!ctx->segment.cues.cue_point.head)
       return -1;
   }
 
-  nestegg_track_count(ctx, &track_count);
-
-  tc_scale = ne_get_timecode_scale(ctx);
-
-  while (cues_node && !range_obtained) {
-    assert(cues_node->id == ID_CUE_POINT);
-    cue_point = cues_node->data;
-    cue_pos_node = cue_point->cue_track_positions.head;
-    while (cue_pos_node) {
-      assert(cue_pos_node->id == ID_CUE_TRACK_POSITIONS);
-      pos = cue_pos_node->data;
-      for (track = 0; track < track_count; track++) {
-        if (ne_get_uint(pos->track, &track_number) != 0)
-          return -1;
-
-        if (ne_map_track_number_to_index(ctx, track_number, &track_index) != 0)
-          return -1;
+  index = ne_get_cue_index(ctx);
+  if (!index)
+    return -1;
 
-        if (track_index == track) {
-          if (ne_get_uint(pos->cluster_position, &seek_pos) != 0)
-            return -1;
-          if (cluster_count == cluster_num) {
-            *start_pos = ctx->segment_offset+seek_pos;
-            if (ne_get_uint(cue_point->time, &time) != 0)
-              return -1;
-            *tstamp = time * tc_scale;
-          } else if (cluster_count == cluster_num+1) {
-            *end_pos = (ctx->segment_offset+seek_pos)-1;
-            range_obtained = 1;
-            break;
-          }
-          cluster_count++;
-        }
-      }
-      cue_pos_node = cue_pos_node->next;
-    }
-    cues_node = cues_node->next;
+  if (cluster_num < index->count) {
+    *start_pos = ctx->segment_offset + index->entries[cluster_num].position;
+    *tstamp = index->entries[cluster_num].time * ne_get_timecode_scale(ctx);
   }
+  if (cluster_num + 1 < index->count)
+    *end_pos = ctx->segment_offset + index->entries[cluster_num + 1].position - 1;
 
   return 0;
 }
@@ -2108,6 +2888,8 @@ nestegg_offset_seek(nestegg * ctx, uint64_t offset)
   if (r != 0)
     return -1;
   ctx->last_valid = 0;
+  ctx->cluster_start = -1;
+  ctx->cluster_previous = -1;
 
   while (ctx->ancestor)
     ne_ctx_pop(ctx);
@@ -2123,42 +2905,168 @@ nestegg_offset_seek(nestegg * ctx, uint64_t offset)
   return 0;
 }
 
+int
+nestegg_last_cluster_offset(nestegg * ctx, int64_t * offset)
+{
+  /* Set by the first block read from each cluster. */
+  if (ctx->cluster_previous < 0)
+    return -1;
+
+  *offset = ctx->segment_offset + ctx->cluster_previous;
+
+  return 0;
+}
+
 int
 nestegg_track_seek(nestegg * ctx, unsigned int track, uint64_t tstamp)
 {
   int r;
-  struct cue_point * cue_point;
-  struct cue_track_positions * pos;
-  uint64_t seek_pos, tc_scale;
+  struct cue_index * index;
+  struct cue_entry * cue;
+  uint64_t position;
+
+  if (track >= ctx->track_count)
+    return -1;
 
   /* If there are no cues loaded, check for cues element in the seek head
-     and load it. */
-  if (!ctx->segment.cues.cue_point.head) {
-    r = ne_init_cue_points(ctx, -1);
-    if (r != 0)
+     and load it.  Files without cues seek by cluster instead. */
+  if (!ctx->segment.cues.cue_point.head && ne_init_cue_points(ctx, -1) != 0) {
+    if (ne_find_cluster_position(ctx, tstamp, &position) != 0)
+      return -1;
+  } else {
+    index = ne_get_cue_index(ctx);
+    if (!index)
       return -1;
+
+    cue = ne_find_cue_for_tstamp(index, track, ne_get_timecode_scale(ctx), tstamp);
+    if (!cue)
+      return -1;
+    position = cue->position;
   }
 
-  tc_scale = ne_get_timecode_scale(ctx);
+  /* Seek and set up parser state for segment-level element (Cluster). */
+  r = nestegg_offset_seek(ctx, ctx->segment_offset + position);
+  if (r != 0)
+    return -1;
 
-  cue_point = ne_find_cue_point_for_tstamp(ctx, ctx->segment.cues.cue_point.head,
-                                           track, tc_scale, tstamp);
-  if (!cue_point)
+  if (!ne_is_suspend_element(ctx->last_id))
     return -1;
 
-  pos = ne_find_cue_position_for_track(ctx, cue_point->cue_track_positions.head, track);
-  if (pos == NULL)
+  return 0;
+}
+
+int
+nestegg_index_clusters(nestegg * ctx)
+{
+  /* Runs of clusters already indexed are skipped, so starting over from the
+     top of the segment only costs reads for the gaps. */
+  return ne_scan_clusters(ctx, ctx->segment_offset, UINT64_MAX);
+}
+
+static void
+ne_put_le(unsigned char * p, uint64_t value, unsigned int bytes)
+{
+  unsigned int i;
+
+  for (i = 0; i < bytes; ++i)
+    p[i] = (unsigned char) (value >> (i * 8));
+}
+
+static uint64_t
+ne_get_le(unsigned char const * p, unsigned int bytes)
+{
+  uint64_t value = 0;
+
+  while (bytes--)
+    value = (value << 8) | p[bytes];
+  return value;
+}
+
+int
+nestegg_save_cluster_index(nestegg * ctx, unsigned char * buffer, size_t * length)
+{
+  struct cluster_index * index = &ctx->cluster_index;
+  size_t i, needed;
+  int64_t stream_length;
+
+  needed = CLUSTER_INDEX_HEADER + index->count * CLUSTER_INDEX_ENTRY;
+  if (!buffer) {
+    *length = needed;
+    return 0;
+  }
+  if (*length < needed) {
+    *length = needed;
     return -1;
+  }
+  stream_length = ne_io_length(ctx->io);
+  if (stream_length < 0)
+    return -1;
+
+  memcpy(buffer, CLUSTER_INDEX_MAGIC, 4);
+  ne_put_le(buffer + 4, CLUSTER_INDEX_VERSION, 4);
+  ne_put_le(buffer + 8, index->count, 8);
+  ne_put_le(buffer + 16, (uint64_t) ctx->segment_offset, 8);
+  ne_put_le(buffer + 24, (uint64_t) stream_length, 8);
+  buffer += CLUSTER_INDEX_HEADER;
+  for (i = 0; i < index->count; ++i) {
+    ne_put_le(buffer, index->entries[i].position, 8);
+    ne_put_le(buffer + 8, index->entries[i].timecode, 8);
+    buffer[16] = index->entries[i].next_known ? 1 : 0;
+    buffer += CLUSTER_INDEX_ENTRY;
+  }
+
+  *length = needed;
+  return 0;
+}
+
+int
+nestegg_load_cluster_index(nestegg * ctx, unsigned char const * buffer, size_t length)
+{
+  struct cluster_index * index = &ctx->cluster_index;
+  struct cluster_entry * entries;
+  uint64_t count;
+  size_t i;
+  int64_t stream_length;
 
-  if (ne_get_uint(pos->cluster_position, &seek_pos) != 0)
+  if (!buffer || length < CLUSTER_INDEX_HEADER ||
+      memcmp(buffer, CLUSTER_INDEX_MAGIC, 4) != 0 ||
+      ne_get_le(buffer + 4, 4) != CLUSTER_INDEX_VERSION)
     return -1;
 
-  /* Seek and set up parser state for segment-level element (Cluster). */
-  r = nestegg_offset_seek(ctx, ctx->segment_offset + seek_pos);
+  /* An index for another file, or for this one before it grew, would send
+     seeks to arbitrary offsets. */
+  stream_length = ne_io_length(ctx->io);
+  if (stream_length < 0 ||
+      ne_get_le(buffer + 16, 8) != (uint64_t) ctx->segment_offset ||
+      ne_get_le(buffer + 24, 8) != (uint64_t) stream_length)
+    return -1;
 
-  if (!ne_is_suspend_element(ctx->last_id))
+  count = ne_get_le(buffer + 8, 8);
+  if (count > (length - CLUSTER_INDEX_HEADER) / CLUSTER_INDEX_ENTRY ||
+      length != CLUSTER_INDEX_HEADER + count * CLUSTER_INDEX_ENTRY)
     return -1;
 
+  entries = malloc((count ? count : 1) * sizeof(*entries));
+  if (!entries)
+    return -1;
+  buffer += CLUSTER_INDEX_HEADER;
+  for (i = 0; i < count; ++i) {
+    entries[i].position = ne_get_le(buffer, 8);
+    entries[i].timecode = ne_get_le(buffer + 8, 8);
+    entries[i].next_known = buffer[16] == 1;
+    if (buffer[16] > 1 || (i > 0 && entries[i].position <= entries[i - 1].position)) {
+      free(entries);
+      return -1;
+    }
+    buffer += CLUSTER_INDEX_ENTRY;
+  }
+  if (count > 0)
+    entries[count - 1].next_known = 0;
+
+  free(index->entries);
+  index->entries = entries;
+  index->count = count;
+  index->capacity = count ? count : 1;
   return 0;
 }
 
@@ -2441,6 +3349,14 @@ nestegg_read_packet(nestegg * ctx, nestegg_packet ** pkt)
       if (r != 1)
         return r;
 
+      /* Captures that were never finalized end on a block, with nothing
+         after it to read. */
+      r = ne_peek_element(ctx, NULL, NULL);
+      if (r == 0)
+        return 1;
+      if (r != 1)
+        return r;
+
       r = ne_read_block_duration(ctx, *pkt);
       if (r != 1)
         return r;
@@ -2464,6 +3380,38 @@ nestegg_read_packet(nestegg * ctx, nestegg_packet ** pkt)
   return 1;
 }
 
+int
+nestegg_read_packet_into(nestegg * ctx, nestegg_packet ** pkt)
+{
+  int r;
+
+  if (*pkt) {
+    ne_packet_recycle(ctx, *pkt);
+    *pkt = NULL;
+  }
+
+  r = nestegg_read_packet(ctx, pkt);
+  if (r != 1 && *pkt) {
+    ne_packet_recycle(ctx, *pkt);
+    *pkt = NULL;
+  }
+
+  return r;
+}
+
+void
+nestegg_recycle_packet(nestegg * ctx, nestegg_packet * pkt)
+{
+  ne_packet_recycle(ctx, pkt);
+}
+
+int
+nestegg_get_stats(nestegg * ctx, nestegg_stats * stats)
+{
+  *stats = ctx->stats;
+  return 0;
+}
+
 void
 nestegg_free_packet(nestegg_packet * pkt)
 {
@@ -47,11 +47,11 @@ int file_seek(int64_t n, int whence, void *context)
 	FILE* f = (FILE*)context;
 	switch(whence) {
 	case NESTEGG_SEEK_SET:
-		return fseek(f, whence, SEEK_SET);
+		return fseek(f, (long)n, SEEK_SET);
 	case NESTEGG_SEEK_CUR:
-		return fseek(f, whence, SEEK_CUR);
+		return fseek(f, (long)n, SEEK_CUR);
 	case NESTEGG_SEEK_END:
-		return fseek(f, whence, SEEK_END);
+		return fseek(f, (long)n, SEEK_END);
 	}
 	return -1;
 }
@@ -119,7 +119,7 @@ void play_webm(char const* name) {
   vparams.width = 0;
   vparams.height = 0;
 
-  vpx_codec_iface_t* interface;
+  vpx_codec_iface_t* interface = NULL;
   for (int i=0; i < ntracks; ++i) {
     int id = nestegg_track_codec_id(ne, i);
     assert(id >= 0);
@@ -128,7 +128,7 @@ void play_webm(char const* name) {
     if (id == NESTEGG_CODEC_VP9)
         interface = &vpx_codec_vp9_dx_algo;
     else if (id == NESTEGG_CODEC_VP8)
-        &vpx_codec_vp8_dx_algo;
+        interface = &vpx_codec_vp8_dx_algo;
     if (type == NESTEGG_TRACK_VIDEO) {
             
       r = nestegg_track_video_params(ne, i, &vparams);
@@ -242,15 +242,15 @@ void play_webm(char const* name) {
           for (int y=0; y < img->d_h; ++y)
             memcpy(overlay->pixels[0]+(overlay->pitches[0]*y), 
 	           img->planes[0]+(img->stride[0]*y), 
-	           overlay->pitches[0]);
+	           img->d_w);
           for (int y=0; y < img->d_h>>1; ++y)
             memcpy(overlay->pixels[1]+(overlay->pitches[1]*y), 
 	           img->planes[2]+(img->stride[2]*y), 
-	           overlay->pitches[1]);
+	           (img->d_w+1)>>1);
           for (int y=0; y < img->d_h>>1; ++y)
             memcpy(overlay->pixels[2]+(overlay->pitches[2]*y), 
 	           img->planes[1]+(img->stride[1]*y), 
-	           overlay->pitches[2]);
+	           (img->d_w+1)>>1);
            SDL_UnlockYUVOverlay(overlay);	  
            SDL_DisplayYUVOverlay(overlay, &rect);
 		   SDL_Delay(30);